@@ -0,0 +1,418 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bandio.h"
+#include "pnm.h"
+
+#define HEADER_FIELDS 4
+
+long shareHeader(const char *fileName, image *img, int layout, MPI_Comm comm) {
+    int rank;
+    int fields[HEADER_FIELDS];
+    long dataOffset = 0;
+
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0) {
+        mappedFile map;
+        mapFile(fileName, 0, 0, 0, &map);
+        dataOffset = parseHeader(map.bytes, map.fileSize, img, layout);
+        unmapFile(&map);
+        requireSamples(img);
+
+        fields[0] = img->type;
+        fields[1] = img->width;
+        fields[2] = img->height;
+        fields[3] = img->maxval;
+    }
+
+    MPI_Bcast(fields, HEADER_FIELDS, MPI_INT, 0, comm);
+    MPI_Bcast(&dataOffset, 1, MPI_LONG, 0, comm);
+    if (rank != 0) {
+        initImage(img, fields[0], fields[1], fields[2], fields[3], layout);
+    }
+    return dataOffset;
+}
+
+// memory layout of rows stored rows, skipping the padding of every row
+static MPI_Datatype createPaddedRowsType(const image *img, int rows) {
+    MPI_Datatype rowsType;
+
+    MPI_Type_create_hvector(rows, img->rowSamples, (MPI_Aint)img->stride,
+        MPI_UNSIGNED_CHAR, &rowsType);
+    MPI_Type_commit(&rowsType);
+    return rowsType;
+}
+
+static MPI_Datatype createFileRowType(const image *img) {
+    MPI_Datatype rowType;
+
+    MPI_Type_contiguous((int)fileRowBytes(img), MPI_UNSIGNED_CHAR, &rowType);
+    MPI_Type_commit(&rowType);
+    return rowType;
+}
+
+static void readBandMpi(const char *fileName, image *img, long dataOffset,
+    int firstRow, int rows, MPI_Comm comm) {
+    MPI_File file;
+    MPI_Offset offset = dataOffset + firstRow * fileRowBytes(img);
+
+    if (MPI_File_open(comm, fileName, MPI_MODE_RDONLY, MPI_INFO_NULL, &file)
+        != MPI_SUCCESS) {
+        fprintf(stderr, "error opening input file %s\n", fileName);
+        MPI_Abort(comm, 1);
+    }
+
+    if (img->layout == INTERLEAVED) {  // straight into the padded rows
+        MPI_Datatype rowsType = createPaddedRowsType(img, rows > 0 ? rows : 1);
+        MPI_File_read_at_all(file, offset, imageRow(img, 0, firstRow),
+            rows > 0 ? 1 : 0, rowsType, MPI_STATUS_IGNORE);
+        MPI_Type_free(&rowsType);
+    } else {  // through a staging buffer, then split over the planes
+        MPI_Datatype rowType = createFileRowType(img);
+        unsigned char *buffer = (unsigned char *)malloc(
+            (rows > 0 ? rows : 1) * fileRowBytes(img));
+
+        MPI_File_read_at_all(file, offset, buffer, rows, rowType,
+            MPI_STATUS_IGNORE);
+        for (int i = 0; i < rows; i++) {
+            deinterleaveRow(img, firstRow + i, buffer + i * fileRowBytes(img));
+        }
+        free(buffer);
+        MPI_Type_free(&rowType);
+    }
+    MPI_File_close(&file);
+}
+
+void readBand(const char *fileName, image *img, long dataOffset, int firstRow,
+    int rows, int io, MPI_Comm comm) {
+    allocRows(img, firstRow, rows);
+
+    if (io == IO_MPI) {
+        readBandMpi(fileName, img, dataOffset, firstRow, rows, comm);
+        return;
+    }
+
+    if (rows == 0) {
+        return;
+    }
+    // map just the band and copy it out of the page cache
+    mappedFile map;
+    mapFile(fileName, dataOffset + firstRow * fileRowBytes(img),
+        rows * fileRowBytes(img), 0, &map);
+    loadRows(img, firstRow, rows, map.bytes);
+    unmapFile(&map);
+}
+
+static void writeBandsMpi(const char *fileName, image *img, int rowLow,
+    int rowHigh, MPI_Comm comm) {
+    int rank;
+    int rows = rowHigh - rowLow;
+    char header[HEADER_MAX];
+    int headerSize = formatHeader(img, header);
+    MPI_Offset offset = headerSize + rowLow * fileRowBytes(img);
+    MPI_File file;
+
+    MPI_Comm_rank(comm, &rank);
+    if (MPI_File_open(comm, fileName, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+        MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        fprintf(stderr, "error opening output file %s\n", fileName);
+        MPI_Abort(comm, 1);
+    }
+    // drop whatever an older, longer file had past the new payload
+    MPI_File_set_size(file, headerSize + img->height * fileRowBytes(img));
+
+    if (rank == 0) {
+        MPI_File_write_at(file, 0, header, headerSize, MPI_CHAR,
+            MPI_STATUS_IGNORE);
+    }
+
+    if (img->layout == INTERLEAVED) {
+        MPI_Datatype rowsType = createPaddedRowsType(img, rows > 0 ? rows : 1);
+        MPI_File_write_at_all(file, offset, rows > 0 ? imageRow(img, 0, rowLow) : img->data,
+            rows > 0 ? 1 : 0, rowsType, MPI_STATUS_IGNORE);
+        MPI_Type_free(&rowsType);
+    } else {
+        MPI_Datatype rowType = createFileRowType(img);
+        unsigned char *buffer = (unsigned char *)malloc(
+            (rows > 0 ? rows : 1) * fileRowBytes(img));
+
+        for (int i = 0; i < rows; i++) {
+            interleaveRow(img, rowLow + i, buffer + i * fileRowBytes(img));
+        }
+        MPI_File_write_at_all(file, offset, buffer, rows, rowType,
+            MPI_STATUS_IGNORE);
+        free(buffer);
+        MPI_Type_free(&rowType);
+    }
+    MPI_File_close(&file);
+}
+
+long prepareOutput(const char *fileName, const image *img, MPI_Comm comm) {
+    int rank;
+    char header[HEADER_MAX];
+    int headerSize = formatHeader(img, header);
+
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0) {
+        int fd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, headerSize
+            + (off_t)img->height * fileRowBytes(img)) != 0) {
+            perror("error creating output file");
+            MPI_Abort(comm, 1);
+        }
+        writeFully(fd, header, headerSize);
+        close(fd);
+    }
+    MPI_Barrier(comm);
+    return headerSize;
+}
+
+static void writeBandsMapped(const char *fileName, const image *img,
+    int rowLow, int rowHigh, MPI_Comm comm) {
+    int rows = rowHigh - rowLow;
+
+    // the leader sizes the file once, then every rank maps its own rows
+    long headerSize = prepareOutput(fileName, img, comm);
+    if (rows == 0) {
+        return;
+    }
+    mappedFile map;
+    mapFile(fileName, headerSize + rowLow * fileRowBytes(img),
+        rows * fileRowBytes(img), 1, &map);
+    storeRows(img, rowLow, rows, map.bytes);
+    unmapFile(&map);
+}
+
+static void writeBandsPosix(const char *fileName, const image *img,
+    int rowLow, int rowHigh, MPI_Comm comm) {
+    int rows = rowHigh - rowLow;
+
+    // the leader sizes the file once, then every rank writes at its offset
+    long headerSize = prepareOutput(fileName, img, comm);
+    if (rows == 0) {
+        return;
+    }
+    int fd = open(fileName, O_WRONLY);
+    if (fd < 0 || lseek(fd, headerSize + rowLow * (off_t)fileRowBytes(img),
+        SEEK_SET) < 0) {
+        perror("error opening output file");
+        MPI_Abort(comm, 1);
+    }
+    writeRows(fd, img, rowLow, rows);
+    close(fd);
+}
+
+// every band sent to rank 0, which writes them in rank order
+static void writeBandsFunnel(const char *fileName, image *img, int rowLow,
+    int rowHigh, MPI_Comm comm) {
+    int rank, size;
+    int bounds[2] = {rowLow, rowHigh};
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int *allBounds = rank == 0 ? (int *)malloc(2 * size * sizeof(int)) : NULL;
+    MPI_Gather(bounds, 2, MPI_INT, allBounds, 2, MPI_INT, 0, comm);
+
+    // a band larger than one message goes in pieces of messageRows rows
+    int pieceRows = messageRows(img);
+    if (rank != 0) {
+        for (int row = rowLow; row < rowHigh; row += pieceRows) {
+            int rows = rowHigh - row < pieceRows ? rowHigh - row : pieceRows;
+            MPI_Datatype rowsType = createRowsType(img, rows);
+            MPI_Send(imageRow(img, 0, row), 1, rowsType, 0, BAND_TAG, comm);
+            MPI_Type_free(&rowsType);
+        }
+        return;
+    }
+
+    int fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("error opening output file");
+        MPI_Abort(comm, 1);
+    }
+    writeHeader(fd, img);
+
+    // bands arrive in row order, so only one of them is held at a time
+    for (int i = 0; i < size; i++) {
+        int low = allBounds[2 * i];
+        int high = allBounds[2 * i + 1];
+
+        if (low == high) {
+            continue;
+        }
+        if (i == 0) {
+            writeRows(fd, img, low, high - low);
+            continue;
+        }
+
+        image band = *img;
+        allocRows(&band, low, high - low);
+        for (int row = low; row < high; row += pieceRows) {
+            int rows = high - row < pieceRows ? high - row : pieceRows;
+            MPI_Datatype rowsType = createRowsType(&band, rows);
+            MPI_Recv(imageRow(&band, 0, row), 1, rowsType, i, BAND_TAG, comm,
+                MPI_STATUS_IGNORE);
+            MPI_Type_free(&rowsType);
+        }
+        writeRows(fd, &band, low, high - low);
+        freeImage(&band);
+    }
+    close(fd);
+    free(allBounds);
+}
+
+void writeBands(const char *fileName, image *img, int rowLow, int rowHigh,
+    int io, MPI_Comm comm) {
+    if (io == IO_MPI) {
+        writeBandsMpi(fileName, img, rowLow, rowHigh, comm);
+    } else if (io == IO_MMAP) {
+        writeBandsMapped(fileName, img, rowLow, rowHigh, comm);
+    } else if (io == IO_FUNNEL) {
+        writeBandsFunnel(fileName, img, rowLow, rowHigh, comm);
+    } else {
+        writeBandsPosix(fileName, img, rowLow, rowHigh, comm);
+    }
+}
+
+static int rectIsEmpty(tileRect rect) {
+    return rect.rowLow == rect.rowHigh || rect.colLow == rect.colHigh;
+}
+
+// the rect in the payload of a file, a single sample for empty rects
+static MPI_Datatype createTileFileType(const image *shape, tileRect rect) {
+    MPI_Datatype tileType;
+    int empty = rectIsEmpty(rect);
+    int sizes[2] = {shape->height, (int)fileRowBytes(shape)};
+    int subsizes[2] = {empty ? 1 : rect.rowHigh - rect.rowLow,
+        empty ? 1 : (rect.colHigh - rect.colLow) * shape->channels};
+    int starts[2] = {empty ? 0 : rect.rowLow,
+        empty ? 0 : rect.colLow * shape->channels};
+
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C,
+        MPI_UNSIGNED_CHAR, &tileType);
+    MPI_Type_commit(&tileType);
+    return tileType;
+}
+
+// collective read or write of every rect through a file view
+static void accessTilesMpi(MPI_File file, const image *shape,
+    MPI_Offset dataOffset, tileRect rect, unsigned char *buffer, int writing) {
+    MPI_Datatype tileType = createTileFileType(shape, rect);
+    int count = rectIsEmpty(rect) ? 0 : (rect.rowHigh - rect.rowLow)
+        * (rect.colHigh - rect.colLow) * shape->channels;
+
+    MPI_File_set_view(file, dataOffset, MPI_UNSIGNED_CHAR, tileType, "native",
+        MPI_INFO_NULL);
+    if (writing) {
+        MPI_File_write_all(file, buffer, count, MPI_UNSIGNED_CHAR,
+            MPI_STATUS_IGNORE);
+    } else {
+        MPI_File_read_all(file, buffer, count, MPI_UNSIGNED_CHAR,
+            MPI_STATUS_IGNORE);
+    }
+    MPI_Type_free(&tileType);
+}
+
+void readTile(const char *fileName, const image *shape, long dataOffset,
+    image *img, tileRect rect, int io, MPI_Comm comm) {
+    int rows = rect.rowHigh - rect.rowLow;
+    int columns = rect.colHigh - rect.colLow;
+    size_t tileRowBytes = (size_t)columns * shape->channels;
+
+    allocRows(img, rect.rowLow, rows);
+
+    if (io == IO_MPI) {  // the rect alone through a staging buffer
+        MPI_File file;
+        unsigned char *buffer = (unsigned char *)malloc(
+            rectIsEmpty(rect) ? 1 : rows * tileRowBytes);
+
+        if (MPI_File_open(comm, fileName, MPI_MODE_RDONLY, MPI_INFO_NULL,
+            &file) != MPI_SUCCESS) {
+            fprintf(stderr, "error opening input file %s\n", fileName);
+            MPI_Abort(comm, 1);
+        }
+        accessTilesMpi(file, shape, dataOffset, rect, buffer, 0);
+        MPI_File_close(&file);
+        loadTile(img, rect.rowLow, rectIsEmpty(rect) ? 0 : rows, 0, columns,
+            buffer, tileRowBytes);
+        free(buffer);
+        return;
+    }
+
+    if (rectIsEmpty(rect)) {
+        return;
+    }
+    // map the whole rows, only the rect columns are touched
+    mappedFile map;
+    mapFile(fileName, dataOffset + rect.rowLow * fileRowBytes(shape),
+        rows * fileRowBytes(shape), 0, &map);
+    loadTile(img, rect.rowLow, rows, 0, columns,
+        map.bytes + rect.colLow * shape->channels, fileRowBytes(shape));
+    unmapFile(&map);
+}
+
+void writeTiles(const char *fileName, const image *shape, const image *img,
+    int imgColumn, tileRect rect, int io, MPI_Comm comm) {
+    int rows = rect.rowHigh - rect.rowLow;
+    int columns = rect.colHigh - rect.colLow;
+    size_t tileRowBytes = (size_t)columns * shape->channels;
+
+    if (io == IO_MPI) {
+        int rank;
+        char header[HEADER_MAX];
+        int headerSize = formatHeader(shape, header);
+        MPI_File file;
+        unsigned char *buffer = (unsigned char *)malloc(
+            rectIsEmpty(rect) ? 1 : rows * tileRowBytes);
+
+        MPI_Comm_rank(comm, &rank);
+        if (MPI_File_open(comm, fileName, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+            MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+            fprintf(stderr, "error opening output file %s\n", fileName);
+            MPI_Abort(comm, 1);
+        }
+        MPI_File_set_size(file, headerSize + shape->height * fileRowBytes(shape));
+        if (rank == 0) {
+            MPI_File_write_at(file, 0, header, headerSize, MPI_CHAR,
+                MPI_STATUS_IGNORE);
+        }
+        storeTile(img, rect.rowLow, rectIsEmpty(rect) ? 0 : rows,
+            imgColumn, columns, buffer, tileRowBytes);
+        accessTilesMpi(file, shape, headerSize, rect, buffer, 1);
+        MPI_File_close(&file);
+        free(buffer);
+        return;
+    }
+
+    // the leader sizes the file once, then every rank maps its own rows
+    long headerSize = prepareOutput(fileName, shape, comm);
+    if (rectIsEmpty(rect)) {
+        return;
+    }
+    mappedFile map;
+    mapFile(fileName, headerSize + rect.rowLow * fileRowBytes(shape),
+        rows * fileRowBytes(shape), 1, &map);
+    storeTile(img, rect.rowLow, rows, imgColumn, columns,
+        map.bytes + rect.colLow * shape->channels, fileRowBytes(shape));
+    unmapFile(&map);
+}
+
+int parseIo(const char *name) {
+    if (strcmp(name, "posix") == 0) {
+        return IO_POSIX;
+    }
+    if (strcmp(name, "mpi") == 0) {
+        return IO_MPI;
+    }
+    if (strcmp(name, "mmap") == 0) {
+        return IO_MMAP;
+    }
+    if (strcmp(name, "funnel") == 0) {
+        return IO_FUNNEL;
+    }
+    fprintf(stderr, "unknown io mode: %s\n", name);
+    exit(1);
+}
@@ -0,0 +1,52 @@
+#ifndef BANDIO_H
+#define BANDIO_H
+
+#include <mpi.h>
+
+#include "image.h"
+
+// how the ranks reach the files
+#define IO_POSIX 0  // mapped reads, every rank writes its rows in place
+#define IO_MPI 1  // collective MPI-IO reads and writes at each band offset
+#define IO_MMAP 2  // mapped reads, every rank stores into the mapped output
+#define IO_FUNNEL 3  // mapped reads, the leader writes every band in order
+
+#define BAND_TAG 3
+
+// parse the header once on rank 0 of comm and share the shape; returns the
+// payload offset, exits on images the filters do not take
+long shareHeader(const char *fileName, image *img, int layout, MPI_Comm comm);
+
+// allocate and read the rows [firstRow, firstRow + rows) on every rank
+void readBand(const char *fileName, image *img, long dataOffset, int firstRow,
+    int rows, int io, MPI_Comm comm);
+
+// write the rows [rowLow, rowHigh) owned by every rank in one file
+void writeBands(const char *fileName, image *img, int rowLow, int rowHigh,
+    int io, MPI_Comm comm);
+
+// a rectangle of image rows and columns, high ends excluded
+typedef struct {
+    int rowLow;
+    int rowHigh;
+    int colLow;
+    int colHigh;
+}tileRect;
+
+// allocate and read the rows and columns of rect on every rank, of a file
+// shaped like shape; img holds just the rect columns
+void readTile(const char *fileName, const image *shape, long dataOffset,
+    image *img, tileRect rect, int io, MPI_Comm comm);
+
+// write the rect owned by every rank in one file shaped like shape; column
+// 0 of img is image column imgColumn
+void writeTiles(const char *fileName, const image *shape, const image *img,
+    int imgColumn, tileRect rect, int io, MPI_Comm comm);
+
+// create the output with its header and full size on rank 0 of comm, so
+// every rank can then write its rows in place; returns the payload offset
+long prepareOutput(const char *fileName, const image *img, MPI_Comm comm);
+
+int parseIo(const char *name);
+
+#endif
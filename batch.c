@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "pipeline.h"
+#include "pnm.h"
+#include "profile.h"
+#include "tune.h"
+
+#define MANIFEST_SEPARATORS " \t\r\n"
+
+// the lines of a manifest holding a job, blank lines and # comments skipped
+static char **readManifest(const char *fileName, int *count) {
+    FILE *filePointer = fopen(fileName, "r");
+    if (filePointer == NULL) {
+        perror("error opening manifest");
+        exit(1);
+    }
+
+    char **lines = NULL;
+    int capacity = 0;
+    char *line = NULL;
+    size_t length = 0;
+
+    *count = 0;
+    while (getline(&line, &length, filePointer) != -1) {
+        size_t start = strspn(line, MANIFEST_SEPARATORS);
+        if (line[start] == '\0' || line[start] == '#') {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity = capacity > 0 ? 2 * capacity : 64;
+            lines = (char **)realloc(lines, capacity * sizeof(char *));
+        }
+        lines[(*count)++] = strdup(line + start);
+    }
+    free(line);
+    fclose(filePointer);
+    return lines;
+}
+
+// split a manifest line in place into a job, free the chain when done
+static void parseJob(char *line, imageJob *job) {
+    int tokens = 0;
+    const char *fields[2] = {NULL, NULL};
+
+    // every filter name takes at least two characters with its separator
+    job->chain = (const filterDef **)malloc((strlen(line) / 2 + 1)
+        * sizeof(filterDef *));
+    job->filterCount = 0;
+    char *token = strtok(line, MANIFEST_SEPARATORS);
+    for (; token != NULL; token = strtok(NULL, MANIFEST_SEPARATORS)) {
+        if (tokens < 2) {
+            fields[tokens++] = token;
+        } else {
+            job->chain[job->filterCount++] = findFilter(token);
+        }
+    }
+    if (tokens < 2) {
+        fprintf(stderr, "manifest line without an output: %s\n",
+            tokens > 0 ? fields[0] : "");
+        exit(1);
+    }
+    job->input = fields[0];
+    job->output = fields[1];
+}
+
+void runLine(const char *line, const options *opts, threadPool *pool,
+    MPI_Comm comm) {
+    char *copy = strdup(line);
+    imageJob job;
+
+    parseJob(copy, &job);
+    processImage(&job, opts, pool, comm);
+    free(job.chain);
+    free(copy);
+}
+
+// bytes of samples in the input of a manifest line, checking the line
+static long inputSize(const char *line) {
+    char *copy = strdup(line);
+    imageJob job;
+    mappedFile map;
+    image img;
+
+    parseJob(copy, &job);
+    mapFile(job.input, 0, 0, 0, &map);
+    parseHeader(map.bytes, map.fileSize, &img, INTERLEAVED);
+    unmapFile(&map);
+    requireSamples(&img);
+    free(job.chain);
+    free(copy);
+    return (long)fileRowBytes(&img) * img.height;
+}
+
+char *shareLine(const char *line, MPI_Comm comm) {
+    int rank;
+    int length = 0;
+
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0) {
+        length = (int)strlen(line) + 1;
+    }
+    MPI_Bcast(&length, 1, MPI_INT, 0, comm);
+    char *copy = (char *)malloc(length);
+    if (rank == 0) {
+        memcpy(copy, line, length);
+    }
+    MPI_Bcast(copy, length, MPI_CHAR, 0, comm);
+    return copy;
+}
+
+// answer a worker asking for work: the next job, or an empty one to stop
+// it once none is left
+static void replyJob(char **lines, const int *jobs, int count, int *next,
+    int *stopped, int worker, MPI_Comm comm) {
+    char none = '\0';
+
+    if (*next < count) {
+        const char *line = lines[jobs[(*next)++]];
+        MPI_Send(line, (int)strlen(line) + 1, MPI_CHAR, worker, JOB_TAG, comm);
+    } else {  // an empty job means no more work
+        MPI_Send(&none, 0, MPI_CHAR, worker, JOB_TAG, comm);
+        (*stopped)++;
+    }
+}
+
+// hand out the jobs to whichever worker asks first and filter one between
+// rounds of requests, then stop every worker; returns the images done here
+static int serveJobs(char **lines, const int *jobs, int count,
+    const options *opts, threadPool *pool, MPI_Comm comm) {
+    int size;
+    int next = 0;
+    int stopped = 0;
+    int done = 0;
+    int ready;
+
+    MPI_Comm_size(comm, &size);
+    while (stopped < size - 1) {
+        MPI_Status status;
+        int asking = 0;
+
+        // workers waiting come first, they idle until answered
+        MPI_Iprobe(MPI_ANY_SOURCE, READY_TAG, comm, &asking, &status);
+        while (asking) {
+            MPI_Recv(&ready, 0, MPI_INT, status.MPI_SOURCE, READY_TAG, comm,
+                MPI_STATUS_IGNORE);
+            replyJob(lines, jobs, count, &next, &stopped, status.MPI_SOURCE,
+                comm);
+            MPI_Iprobe(MPI_ANY_SOURCE, READY_TAG, comm, &asking, &status);
+        }
+
+        if (next < count) {  // nobody else asked, filter one here
+            runLine(lines[jobs[next++]], opts, pool, MPI_COMM_SELF);
+            done++;
+        } else if (stopped < size - 1) {  // just stop whoever is still busy
+            MPI_Recv(&ready, 0, MPI_INT, MPI_ANY_SOURCE, READY_TAG, comm,
+                &status);
+            replyJob(lines, jobs, count, &next, &stopped, status.MPI_SOURCE,
+                comm);
+        }
+    }
+    return done;
+}
+
+// ask rank 0 for whole images until it runs out, returns the images done
+static int workJobs(const options *opts, threadPool *pool, MPI_Comm comm) {
+    int done = 0;
+    int ready = 0;
+
+    for (;;) {
+        MPI_Status status;
+        int length;
+
+        double begin = profileBegin();
+        MPI_Send(&ready, 0, MPI_INT, 0, READY_TAG, comm);
+        MPI_Probe(0, JOB_TAG, comm, &status);
+        MPI_Get_count(&status, MPI_CHAR, &length);
+        char *line = (char *)malloc(length > 0 ? length : 1);
+        MPI_Recv(line, length, MPI_CHAR, 0, JOB_TAG, comm, MPI_STATUS_IGNORE);
+        profilePhase(PHASE_SCHEDULE, begin, length);
+        if (length == 0) {
+            free(line);
+            return done;
+        }
+        runLine(line, opts, pool, MPI_COMM_SELF);
+        free(line);
+        done++;
+    }
+}
+
+// the leader lines as jobs on every rank, parsed from shared copies; free
+// them with freeJobs
+static imageJob *shareJobs(char **lines, int *count, char ***copies,
+    MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    MPI_Bcast(count, 1, MPI_INT, 0, comm);
+    *copies = (char **)malloc((*count > 0 ? *count : 1) * sizeof(char *));
+    imageJob *jobs = (imageJob *)malloc(
+        (*count > 0 ? *count : 1) * sizeof(imageJob));
+    for (int i = 0; i < *count; i++) {
+        (*copies)[i] = shareLine(rank == 0 ? lines[i] : NULL, comm);
+        parseJob((*copies)[i], &jobs[i]);
+    }
+    return jobs;
+}
+
+static void freeJobs(imageJob *jobs, char **copies, int count) {
+    for (int i = 0; i < count; i++) {
+        free(jobs[i].chain);
+        free(copies[i]);
+    }
+    free(jobs);
+    free(copies);
+}
+
+// every image through the stage pipeline, the lines shared with every rank
+static int pipelineLines(char **lines, int count, const options *opts,
+    threadPool *pool, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    char **copies;
+    imageJob *jobs = shareJobs(lines, &count, &copies, comm);
+    pipelineImages(jobs, count, opts, pool, comm);
+    freeJobs(jobs, copies, count);
+    return rank == 0 ? count : 0;
+}
+
+void runBatch(const char *manifest, const options *opts, threadPool *pool,
+    MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    double start = MPI_Wtime();
+
+    // the leader sorts the jobs by the size of their input
+    char **lines = NULL;
+    int count = 0;
+    int *split = NULL;
+    int *whole = NULL;
+    int splitCount = 0;
+    int wholeCount = 0;
+    int done = 0;
+    if (rank == 0) {
+        lines = readManifest(manifest, &count);
+    }
+    if (opts->pipelineGroups != NO_PIPELINE) {  // both lists stay empty
+        done = pipelineLines(lines, count, opts, pool, comm);
+    } else if (rank == 0) {
+        split = (int *)malloc((count > 0 ? count : 1) * sizeof(int));
+        whole = (int *)malloc((count > 0 ? count : 1) * sizeof(int));
+        for (int i = 0; i < count; i++) {
+            if (size > 1 && inputSize(lines[i]) >= opts->splitSize) {
+                split[splitCount++] = i;
+            } else {
+                whole[wholeCount++] = i;
+            }
+        }
+    }
+
+    // large images first, every rank filters a band of each
+    MPI_Bcast(&splitCount, 1, MPI_INT, 0, comm);
+    for (int i = 0; i < splitCount; i++) {
+        char *line = shareLine(rank == 0 ? lines[split[i]] : NULL, comm);
+        runLine(line, opts, pool, comm);
+        free(line);
+    }
+    if (rank == 0) {
+        done += splitCount;
+    }
+
+    // then the small ones, whole, each on the next rank asking for work
+    if (size == 1) {
+        for (int i = 0; i < wholeCount; i++) {
+            runLine(lines[whole[i]], opts, pool, MPI_COMM_SELF);
+        }
+        done += wholeCount;
+    } else if (rank == 0) {
+        done += serveJobs(lines, whole, wholeCount, opts, pool, comm);
+    } else {
+        done += workJobs(opts, pool, comm);
+    }
+
+    int total = 0;
+    MPI_Reduce(&done, &total, 1, MPI_INT, MPI_SUM, 0, comm);
+    double elapsed = MPI_Wtime() - start;
+    if (rank == 0) {
+        printf("%d images in %.3f s, %.1f images/s\n", total, elapsed,
+            elapsed > 0 ? total / elapsed : 0.0);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(lines[i]);
+    }
+    free(lines);
+    free(split);
+    free(whole);
+}
+
+void tuneBatch(const char *manifest, const options *opts, threadPool *pool,
+    MPI_Comm comm) {
+    int rank;
+    char **lines = NULL;
+    int count = 0;
+
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0) {
+        lines = readManifest(manifest, &count);
+    }
+    int leaderCount = count;
+    char **copies;
+    imageJob *jobs = shareJobs(lines, &count, &copies, comm);
+    autotune(jobs, count, opts, pool, comm);
+    freeJobs(jobs, copies, count);
+
+    for (int i = 0; i < leaderCount; i++) {
+        free(lines[i]);
+    }
+    free(lines);
+}
@@ -0,0 +1,33 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <mpi.h>
+
+#include "process.h"
+
+#define DEFAULT_SPLIT_SIZE (16L << 20)
+
+#define READY_TAG 4
+#define JOB_TAG 5
+
+// filter the image of an "input output [filters...]" line with every rank
+// of comm
+void runLine(const char *line, const options *opts, threadPool *pool,
+    MPI_Comm comm);
+
+// share a line of rank 0 with every rank, free it after
+char *shareLine(const char *line, MPI_Comm comm);
+
+// filter every image of a manifest in one MPI job, one "input output
+// [filters...]" line per image; images of at least opts->splitSize bytes
+// are split over every rank, the others go whole to the next idle rank,
+// rank 0 included, unless they all go through the stage pipeline. Rank 0
+// reports the images per second
+void runBatch(const char *manifest, const options *opts, threadPool *pool,
+    MPI_Comm comm);
+
+// autotune every image of a manifest into opts->tuneFile, see autotune
+void tuneBatch(const char *manifest, const options *opts, threadPool *pool,
+    MPI_Comm comm);
+
+#endif
@@ -0,0 +1,196 @@
+#!/bin/bash
+# Scaling benchmark: generates synthetic images, runs every chain at every
+# rank and thread count and writes strong and weak scaling tables as CSV.
+# Every output is compared bit for bit with a one rank run of the scalar
+# kernels, compressed ones once decoded; the script fails if any pixel
+# differs. The tables also hold the bytes of an output and, for compressed
+# ones, the deflate seconds of the slowest rank over every run.
+#
+# Settings, from the environment:
+#   SIZES      image sizes in megapixels for strong scaling (1 4 16)
+#   WEAK_SIZE  megapixels per rank for weak scaling (1)
+#   TYPES      pgm for grey, pnm for color (pgm pnm)
+#   CHAINS     filters, or bssembssem for the ten filter chain
+#              (blur smooth sharpen emboss mean bssembssem)
+#   RANKS      rank counts (1 2 4)
+#   THREADS    threads per rank (1)
+#   REPEAT     runs of every image per measurement (3)
+#   OPTIONS    extra homework options, e.g. "--tiles --block auto"
+#   TUNING     tuning file of the timed runs; with none every run uses the
+#              ranks and threads in its row (none)
+#   OUTPUT     pnm for raw outputs, png or gz for compressed ones (pnm)
+#   MPIRUN     launcher (mpirun)
+#   BENCH_DIR  where images, outputs and tables go (bench_out)
+
+SIZES=${SIZES:-"1 4 16"}
+WEAK_SIZE=${WEAK_SIZE:-1}
+TYPES=${TYPES:-"pgm pnm"}
+CHAINS=${CHAINS:-"blur smooth sharpen emboss mean bssembssem"}
+RANKS=${RANKS:-"1 2 4"}
+THREADS=${THREADS:-"1"}
+REPEAT=${REPEAT:-3}
+OPTIONS=${OPTIONS:-}
+TUNING=${TUNING:-none}
+OUTPUT=${OUTPUT:-pnm}
+MPIRUN=${MPIRUN:-mpirun}
+BENCH_DIR=${BENCH_DIR:-bench_out}
+
+HOMEWORK=$(pwd)/homework
+GENIMAGE=$(pwd)/genimage
+UNPNG=$(pwd)/unpng
+BSSEMBSSEM="blur smooth sharpen emboss mean blur smooth sharpen emboss mean"
+FAILED=0
+
+mkdir -p "$BENCH_DIR"
+STRONG="$BENCH_DIR/strong.csv"
+WEAK="$BENCH_DIR/weak.csv"
+HEADER="type,width,height,chain,ranks,threads,seconds,mp_per_s,speedup,efficiency,match,bytes,encode_s"
+echo "$HEADER" > "$STRONG"
+echo "$HEADER" > "$WEAK"
+
+# filters of a chain name
+chainFilters() {
+    if [ "$1" = bssembssem ]; then
+        echo "$BSSEMBSSEM"
+    else
+        echo "$1"
+    fi
+}
+
+# width and height of a roughly square image of $1 megapixels
+imageSide() {
+    awk -v mp="$1" 'BEGIN { printf "%d", sqrt(mp * 1000000) + 0.5 }'
+}
+
+# generate $1 (pgm|pnm) width $2 height $3 once, print its path
+makeImage() {
+    local path="$BENCH_DIR/synthetic_$2x$3.$1"
+    if [ ! -f "$path" ]; then
+        "$GENIMAGE" "$1" "$2" "$3" "$path" || return 1
+    fi
+    echo "$path"
+}
+
+# the scalar single rank output of image $1 through chain $2, print its path
+makeReference() {
+    local path="$BENCH_DIR/ref_$2_$(basename "$1")"
+    if [ ! -f "$path" ]; then
+        $MPIRUN -np 1 "$HOMEWORK" --tuning none --isa scalar --threads 1 \
+            "$1" "$path" \
+            $(chainFilters "$2") > /dev/null || return 1
+    fi
+    echo "$path"
+}
+
+# the raw rows of output $1, decoded when compressed
+decoded() {
+    case "$OUTPUT" in
+    png) "$UNPNG" "$1" /dev/stdout ;;
+    gz) gzip -dc "$1" ;;
+    *) cat "$1" ;;
+    esac
+}
+
+# run image $1 through chain $2 REPEAT times on $3 ranks with $4 threads,
+# splitting every image over all ranks; print the seconds taken, whether
+# the output matches reference $5, its bytes and the encode seconds
+measure() {
+    local output="$BENCH_DIR/out_$2_$(basename "$1")"
+    local manifest="$BENCH_DIR/manifest.txt"
+    local profile="$BENCH_DIR/profile.json"
+    local seconds match bytes encode=0 timing=
+
+    [ "$OUTPUT" = pnm ] || output="$output.$OUTPUT"
+    [ "$OUTPUT" = pnm ] || timing="--profile $profile"
+    rm -f "$manifest" "$output"
+    for ((i = 0; i < REPEAT; i++)); do
+        echo "$1 $output $(chainFilters "$2")" >> "$manifest"
+    done
+    seconds=$($MPIRUN -np "$3" "$HOMEWORK" --tuning "$TUNING" $OPTIONS \
+        --threads "$4" --split-size 1 $timing "$manifest" |
+        awk '/images in/ { print $4 }')
+    if decoded "$output" | cmp -s - "$5"; then
+        match=yes
+    else
+        match=no
+    fi
+    bytes=$(stat -c %s "$output" 2> /dev/null || echo 0)
+    if [ -n "$timing" ]; then
+        encode=$(awk -F'"max": ' '/"encode"/ { split($2, v, ","); print v[1] }' \
+            "$profile")
+    fi
+    echo "$seconds $match $bytes $encode"
+}
+
+# append a row: type width height chain ranks threads seconds match base
+# scale weak bytes encode, where base is the time of the first
+# configuration and scale the cpus it used
+report() {
+    awk -v type="$1" -v width="$2" -v height="$3" -v chain="$4" \
+        -v ranks="$5" -v threads="$6" -v seconds="$7" -v matches="$8" \
+        -v base="$9" -v baseCpus="${10}" -v weak="${11}" -v bytes="${12}" \
+        -v encode="${13}" -v repeat="$REPEAT" \
+        'BEGIN {
+            mp = width * height / 1000000 * repeat
+            speedup = seconds > 0 ? base / seconds : 0
+            rate = seconds > 0 ? mp / seconds : 0
+            cpus = ranks * threads / baseCpus
+            # weak scaling keeps the work per cpu, ideal time stays the same
+            efficiency = weak ? speedup : speedup / cpus
+            printf "%s,%d,%d,%s,%d,%d,%.4f,%.2f,%.3f,%.3f,%s,%d,%.4f\n", type,
+                width, height, chain, ranks, threads, seconds, rate, speedup,
+                efficiency, matches, bytes, encode
+        }'
+}
+
+firstRanks=$(echo $RANKS | awk '{ print $1 }')
+firstThreads=$(echo $THREADS | awk '{ print $1 }')
+baseCpus=$((firstRanks * firstThreads))
+
+for type in $TYPES; do
+    for chain in $CHAINS; do
+        # strong scaling: the same image on more and more cpus
+        for size in $SIZES; do
+            side=$(imageSide "$size")
+            image=$(makeImage "$type" "$side" "$side") || exit 1
+            reference=$(makeReference "$image" "$chain") || exit 1
+            base=
+            for threads in $THREADS; do
+                for ranks in $RANKS; do
+                    read seconds match bytes encode <<< "$(measure "$image" \
+                        "$chain" "$ranks" "$threads" "$reference")"
+                    base=${base:-$seconds}
+                    [ "$match" = yes ] || FAILED=1
+                    report "$type" "$side" "$side" "$chain" "$ranks" \
+                        "$threads" "$seconds" "$match" "$base" "$baseCpus" 0 \
+                        "$bytes" "$encode" | tee -a "$STRONG"
+                done
+            done
+        done
+
+        # weak scaling: WEAK_SIZE megapixels for every cpu
+        side=$(imageSide "$WEAK_SIZE")
+        base=
+        for threads in $THREADS; do
+            for ranks in $RANKS; do
+                cpus=$((ranks * threads / baseCpus))
+                height=$((side * (cpus > 0 ? cpus : 1)))
+                image=$(makeImage "$type" "$side" "$height") || exit 1
+                reference=$(makeReference "$image" "$chain") || exit 1
+                read seconds match bytes encode <<< "$(measure "$image" \
+                    "$chain" "$ranks" "$threads" "$reference")"
+                base=${base:-$seconds}
+                [ "$match" = yes ] || FAILED=1
+                report "$type" "$side" "$height" "$chain" "$ranks" \
+                    "$threads" "$seconds" "$match" "$base" "$baseCpus" 1 \
+                    "$bytes" "$encode" | tee -a "$WEAK"
+            done
+        done
+    done
+done
+
+if [ $FAILED != 0 ]; then
+    echo "outputs differ from the reference, see the match column" >&2
+    exit 1
+fi
+echo "tables in $STRONG and $WEAK"
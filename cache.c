@@ -0,0 +1,322 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#include <zlib.h>
+
+#include "cache.h"
+#include "bandio.h"
+#include "pnm.h"
+#include "profile.h"
+
+#define HASH_OFFSET 0xcbf29ce484222325UL  // FNV-1a, a byte at a time
+#define HASH_PRIME 0x100000001b3UL
+#define CACHE_PATH_MAX 4096
+
+// what the jobs of this rank found in the cache
+#define CACHE_JOBS 0
+#define CACHE_HITS 1  // the whole chain was cached
+#define CACHE_PARTIAL 2  // a prefix was
+#define CACHE_MISSES 3
+#define CACHE_SAVED 4  // passes read from the cache instead of run
+#define CACHE_PASSES 5  // passes asked for
+#define CACHE_EVICTED 6
+#define CACHE_STORED 7  // entries written, prefixes included
+#define CACHE_COUNTERS 8
+
+static long cacheStats[CACHE_COUNTERS];
+
+// an entry of the cache directory, oldest use first once sorted
+typedef struct {
+    char *name;
+    off_t size;
+    struct timespec used;
+}cacheEntry;
+
+static unsigned long hashBytes(unsigned long hash, const void *bytes,
+    size_t size) {
+    const unsigned char *next = (const unsigned char *)bytes;
+
+    // whole words would let a top bit flip in two words cancel out
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ next[i]) * HASH_PRIME;
+    }
+    return hash;
+}
+
+// the 3x3 filters by name, kernel files by their weights whatever the file
+// is called; how a kernel is applied does not change its pixels
+static unsigned long hashFilter(unsigned long hash, const filterDef *def) {
+    const convolution *conv = def->conv;
+
+    if (conv == NULL) {
+        return hashBytes(hash, def->name, strlen(def->name) + 1);
+    }
+    hash = hashBytes(hash, &conv->size, sizeof(conv->size));
+    hash = hashBytes(hash, &conv->divisor, sizeof(conv->divisor));
+    return hashBytes(hash, conv->weights,
+        (size_t)conv->size * conv->size * sizeof(int));
+}
+
+// the name holds the size and CRC-32 of the input next to the key, so an
+// entry only hits for the input it was made from
+static void entryPath(char *path, const char *dir, const unsigned long *input,
+    unsigned long key) {
+    snprintf(path, CACHE_PATH_MAX, "%s/%016lx-%lx-%08lx%s", dir, key,
+        input[INPUT_SIZE], input[INPUT_CRC], CACHE_SUFFIX);
+}
+
+// write a whole file under another name
+static void copyFile(const char *source, const char *dest) {
+    mappedFile map;
+    mapFile(source, 0, 0, 0, &map);
+
+    int fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("error opening output file");
+        exit(1);
+    }
+    writeFully(fd, map.bytes, map.fileSize);
+    close(fd);
+    unmapFile(&map);
+}
+
+static int olderEntry(const void *a, const void *b) {
+    const cacheEntry *first = (const cacheEntry *)a;
+    const cacheEntry *second = (const cacheEntry *)b;
+
+    if (first->used.tv_sec != second->used.tv_sec) {
+        return first->used.tv_sec < second->used.tv_sec ? -1 : 1;
+    }
+    return (first->used.tv_nsec > second->used.tv_nsec) -
+        (first->used.tv_nsec < second->used.tv_nsec);
+}
+
+// remove the least recently used entries until the rest fit in limit
+// bytes; a hit touches its entry, so the modification time is the last use
+static void evictEntries(const char *dir, long limit) {
+    DIR *directory = opendir(dir);
+    if (directory == NULL) {
+        return;
+    }
+
+    cacheEntry *entries = NULL;
+    int count = 0;
+    int capacity = 0;
+    long total = 0;
+    char path[CACHE_PATH_MAX];
+    size_t suffixLength = strlen(CACHE_SUFFIX);
+    struct dirent *item;
+    while ((item = readdir(directory)) != NULL) {
+        size_t length = strlen(item->d_name);
+        struct stat info;
+        // entries being written start with a dot
+        if (item->d_name[0] == '.' || length <= suffixLength ||
+            strcmp(item->d_name + length - suffixLength, CACHE_SUFFIX) != 0) {
+            continue;
+        }
+        snprintf(path, CACHE_PATH_MAX, "%s/%s", dir, item->d_name);
+        if (stat(path, &info) != 0) {  // evicted by someone else meanwhile
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity > 0 ? 2 * capacity : 64;
+            entries = (cacheEntry *)realloc(entries,
+                capacity * sizeof(cacheEntry));
+        }
+        entries[count].name = strdup(item->d_name);
+        entries[count].size = info.st_size;
+        entries[count].used = info.st_mtim;
+        total += info.st_size;
+        count++;
+    }
+    closedir(directory);
+
+    qsort(entries, count, sizeof(cacheEntry), olderEntry);
+    for (int i = 0; i < count && total > limit; i++) {
+        snprintf(path, CACHE_PATH_MAX, "%s/%s", dir, entries[i].name);
+        if (unlink(path) == 0) {
+            cacheStats[CACHE_EVICTED]++;
+        }
+        total -= entries[i].size;
+    }
+    for (int i = 0; i < count; i++) {
+        free(entries[i].name);
+    }
+    free(entries);
+}
+
+static void makeCacheDir(const char *dir) {
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        perror("error creating cache directory");
+        exit(1);
+    }
+}
+
+// a temporary name for the entry of key, dot first so eviction skips it
+static void temporaryPath(char *path, const char *dir, unsigned long key,
+    int pid) {
+    snprintf(path, CACHE_PATH_MAX, "%s/.%016lx.%d", dir, key, pid);
+}
+
+// move a complete temporary file in place as the entry of key, so no
+// reader sees half an entry, then evict down to limit
+static void publishEntry(const char *temporary, const char *dir, long limit,
+    const unsigned long *input, unsigned long key) {
+    char path[CACHE_PATH_MAX];
+
+    entryPath(path, dir, input, key);
+    if (rename(temporary, path) != 0) {
+        perror("error storing cache entry");
+        unlink(temporary);
+        return;
+    }
+    cacheStats[CACHE_STORED]++;
+    evictEntries(dir, limit);
+}
+
+// copy an output into the cache under its key
+static void storeEntry(const char *dir, long limit, const char *output,
+    const unsigned long *input, unsigned long key) {
+    makeCacheDir(dir);
+
+    struct stat info;
+    if (stat(output, &info) != 0 || info.st_size > limit) {
+        return;
+    }
+    char temporary[CACHE_PATH_MAX];
+    temporaryPath(temporary, dir, key, (int)getpid());
+    copyFile(output, temporary);
+    publishEntry(temporary, dir, limit, input, key);
+}
+
+void storePrefix(const cachePrefixes *prefixes, int passes, image *img,
+    int rowLow, int rowHigh, int io, MPI_Comm comm) {
+    int rank;
+    char header[HEADER_MAX];
+    MPI_Comm_rank(comm, &rank);
+
+    // an entry larger than the whole cache would only evict everything
+    long size = formatHeader(img, header) +
+        (long)fileRowBytes(img) * img->height;
+    if (size > prefixes->limit) {
+        return;
+    }
+
+    // every rank writes its band, like an output, then the leader renames
+    double begin = profileBegin();
+    int pid = (int)getpid();
+    if (rank == 0) {
+        makeCacheDir(prefixes->dir);
+    }
+    MPI_Bcast(&pid, 1, MPI_INT, 0, comm);
+    char temporary[CACHE_PATH_MAX];
+    temporaryPath(temporary, prefixes->dir, prefixes->keys[passes], pid);
+    writeBands(temporary, img, rowLow, rowHigh, io, comm);
+    MPI_Barrier(comm);
+    if (rank == 0) {
+        publishEntry(temporary, prefixes->dir, prefixes->limit,
+            prefixes->input, prefixes->keys[passes]);
+    }
+    profilePhase(PHASE_WRITE, begin,
+        (long)(rowHigh - rowLow) * fileRowBytes(img));
+}
+
+void cachedImage(const imageJob *job, const options *opts, threadPool *pool,
+    MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    int filterCount = job->filterCount;
+
+    // the leader hashes the input once, the key of every prefix follows
+    // from the one before; the longest prefix on disk wins
+    unsigned long *keys = (unsigned long *)malloc((filterCount + 1) *
+        sizeof(unsigned long));  // after every pass, keys[0] the input
+    unsigned long input[INPUT_CHECKS];
+    int found = 0;
+    char path[CACHE_PATH_MAX];
+    if (rank == 0) {
+        mappedFile map;
+        double begin = profileBegin();
+        mapFile(job->input, 0, 0, 0, &map);
+        keys[0] = hashBytes(HASH_OFFSET, map.bytes, map.fileSize);
+        input[INPUT_SIZE] = (unsigned long)map.fileSize;
+        input[INPUT_CRC] = crc32_z(crc32(0, NULL, 0), map.bytes,
+            map.fileSize);
+        profilePhase(PHASE_READ, begin, (long)map.fileSize);
+        unmapFile(&map);
+        for (int i = 0; i < filterCount; i++) {
+            keys[i + 1] = hashFilter(keys[i], job->chain[i]);
+            entryPath(path, opts->cacheDir, input, keys[i + 1]);
+            if (access(path, R_OK) == 0) {
+                found = i + 1;
+            }
+        }
+
+        if (found > 0) {  // the most recently used entry now
+            entryPath(path, opts->cacheDir, input, keys[found]);
+            utime(path, NULL);
+        }
+        cacheStats[CACHE_JOBS]++;
+        cacheStats[found == filterCount ? CACHE_HITS :
+            found > 0 ? CACHE_PARTIAL : CACHE_MISSES]++;
+        cacheStats[CACHE_SAVED] += found;
+        cacheStats[CACHE_PASSES] += filterCount;
+    }
+    MPI_Bcast(&found, 1, MPI_INT, 0, comm);
+    MPI_Bcast(keys, filterCount + 1, MPI_UNSIGNED_LONG, 0, comm);
+    MPI_Bcast(input, INPUT_CHECKS, MPI_UNSIGNED_LONG, 0, comm);
+
+    if (found == filterCount) {  // nothing left to filter
+        if (rank == 0) {
+            entryPath(path, opts->cacheDir, input, keys[found]);
+            copyFile(path, job->output);
+        }
+        free(keys);
+        return;
+    }
+
+    // the rest of the chain starts from the cached prefix, and the band
+    // loop stores the passes it reaches at every block end
+    cachePrefixes prefixes = {opts->cacheDir, opts->cacheSize, keys + found,
+        {input[INPUT_SIZE], input[INPUT_CRC]}};
+    options uncached = *opts;
+    uncached.cacheDir = NULL;
+    uncached.prefixes = &prefixes;
+    imageJob rest = {job->input, job->output, job->chain + found,
+        filterCount - found};
+    if (found > 0) {
+        entryPath(path, opts->cacheDir, input, keys[found]);
+        rest.input = path;
+    }
+    processImage(&rest, &uncached, pool, comm);
+
+    // every rank has written its rows once all are here
+    MPI_Barrier(comm);
+    if (rank == 0) {
+        storeEntry(opts->cacheDir, opts->cacheSize, job->output, input,
+            keys[filterCount]);
+    }
+    free(keys);
+}
+
+void reportCache(MPI_Comm comm) {
+    int rank;
+    long totals[CACHE_COUNTERS];
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Reduce(cacheStats, totals, CACHE_COUNTERS, MPI_LONG, MPI_SUM, 0,
+        comm);
+    if (rank == 0) {
+        printf("cache: %ld jobs, %ld hits, %ld partial hits, %ld misses, "
+            "%ld of %ld passes saved, %ld entries stored, %ld evicted\n",
+            totals[CACHE_JOBS], totals[CACHE_HITS], totals[CACHE_PARTIAL],
+            totals[CACHE_MISSES], totals[CACHE_SAVED], totals[CACHE_PASSES],
+            totals[CACHE_STORED], totals[CACHE_EVICTED]);
+    }
+}
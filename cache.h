@@ -0,0 +1,44 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <mpi.h>
+
+#include "process.h"
+
+#define DEFAULT_CACHE_SIZE (1L << 30)
+#define CACHE_SUFFIX ".pnm"
+
+// what every entry name checks of its input besides the key
+#define INPUT_SIZE 0
+#define INPUT_CRC 1
+#define INPUT_CHECKS 2
+
+// the keys of the passes of a job resumed from the cache, keys[i] the one
+// after i passes of it
+struct cachePrefixes {
+    const char *dir;
+    long limit;  // bytes the entries may take
+    const unsigned long *keys;
+    unsigned long input[INPUT_CHECKS];
+};
+
+// filter one image through the result cache in opts->cacheDir: every entry
+// is the image after a chain prefix on one input, keyed by a hash of the
+// input bytes and of the filters, named by the key and the size and CRC-32
+// of the input, and stored as a binary PNM file. A job
+// resumes from its longest cached prefix; the band loop stores the image
+// at every block end and the job its own output, then the least recently
+// used entries go until opts->cacheSize is met
+void cachedImage(const imageJob *job, const options *opts, threadPool *pool,
+    MPI_Comm comm);
+
+// store the image every rank of comm holds the band [rowLow, rowHigh) of,
+// after passes passes, as the entry of that prefix
+void storePrefix(const cachePrefixes *prefixes, int passes, image *img,
+    int rowLow, int rowHigh, int io, MPI_Comm comm);
+
+// rank 0 of comm prints the hits and misses of every rank and the passes
+// they saved
+void reportCache(MPI_Comm comm);
+
+#endif
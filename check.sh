@@ -0,0 +1,59 @@
+#!/bin/bash
+# Regression check against ref/: runs every filter and the ten filter
+# bssembssem chain on the lenna images of in/ with every row kernel at a
+# few rank counts and compares each output bit for bit with its reference.
+# Row kernels the cpu lacks are skipped; the script fails if any pixel
+# differs.
+#
+# Settings, from the environment:
+#   ISAS       row kernels (scalar sse4.1 avx2 avx512)
+#   RANKS      rank counts (1 2 3 4)
+#   OPTIONS    extra homework options, e.g. "--tiles --block auto"
+#   MPIRUN     launcher (mpirun)
+#   CHECK_DIR  where the outputs go (check_out)
+
+ISAS=${ISAS:-"scalar sse4.1 avx2 avx512"}
+RANKS=${RANKS:-"1 2 3 4"}
+OPTIONS=${OPTIONS:-}
+MPIRUN=${MPIRUN:-mpirun}
+CHECK_DIR=${CHECK_DIR:-check_out}
+
+HOMEWORK=$(pwd)/homework
+CHAINS="blur smooth sharpen emboss mean bssembssem"
+BSSEMBSSEM="blur smooth sharpen emboss mean blur smooth sharpen emboss mean"
+IMAGES="lenna_bw.pgm lenna_color.pnm"
+FAILED=0
+
+mkdir -p "$CHECK_DIR"
+
+for isa in $ISAS; do
+    # a probe run tells whether this cpu has the kernels at all
+    if ! $MPIRUN -np 1 "$HOMEWORK" --tuning none --isa "$isa" \
+        in/lenna_bw.pgm "$CHECK_DIR/probe.pgm" > /dev/null 2>&1; then
+        echo "$isa: not supported here, skipped"
+        continue
+    fi
+    for ranks in $RANKS; do
+        bad=0
+        for image in $IMAGES; do
+            name=${image%.*}
+            type=${image##*.}
+            for chain in $CHAINS; do
+                filters=$chain
+                [ "$chain" = bssembssem ] && filters=$BSSEMBSSEM
+                output="$CHECK_DIR/${name}_$chain.$type"
+                rm -f "$output"
+                $MPIRUN -np "$ranks" "$HOMEWORK" --tuning none --isa "$isa" \
+                    $OPTIONS "in/$image" "$output" $filters > /dev/null
+                if ! cmp -s "$output" "ref/${name}_$chain.$type"; then
+                    echo "$isa, $ranks ranks: $name $chain differs from ref/"
+                    bad=1
+                fi
+            done
+        done
+        [ $bad = 0 ] && echo "$isa, $ranks ranks: ok"
+        FAILED=$((FAILED | bad))
+    done
+done
+
+exit $FAILED
@@ -0,0 +1,680 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "convolve.h"
+#include "kernels.h"
+#include "special.h"
+
+#define CHUNK_SAMPLES 1024  // samples summed at once, the sums stay cached
+#define TOKEN_MAX 64
+#define MIN_FFT_SIZE 16
+#define MAX_FFT_SIZE 256
+
+// cost model, in the time of one tap on one sample of the direct path
+// with AVX-512, measured on 12 megapixels: taps run 16 samples at a time,
+// the transforms are scalar doubles, so the fft only wins past ~500 taps
+#define DIRECT_STORE_COST 4.0  // the division and store of a sum
+#define SEPARABLE_PASS_COST 4.0  // the second pass and its ring of rows
+#define FFT_BUTTERFLY_COST 45.0  // one complex butterfly of a transform
+#define FFT_SAMPLE_COST 60.0  // gather, spectrum product and scatter
+
+typedef void (*accumulateBytesKernel)(int *sums, const unsigned char *samples,
+    int count, int weight);
+typedef void (*accumulateIntsKernel)(int *sums, const int *samples,
+    int count, int weight);
+
+static const accumulateBytesKernel byteKernels[ISA_COUNT] = {
+    accumulateBytesScalar, accumulateBytesSse41, accumulateBytesAvx2,
+    accumulateBytesAvx512
+};
+static const accumulateIntsKernel intKernels[ISA_COUNT] = {
+    accumulateIntsScalar, accumulateIntsSse41, accumulateIntsAvx2,
+    accumulateIntsAvx512
+};
+
+// the time of a tap with every isa, narrower vectors bring the fft closer
+static const double tapCost[ISA_COUNT] = {3.4, 2.2, 1.35, 1.0};
+
+static int selectedMethod = CONV_AUTO;
+
+void selectConvolution(int method) {
+    selectedMethod = method;
+}
+
+int parseConvolution(const char *name) {
+    if (strcmp(name, "auto") == 0) {
+        return CONV_AUTO;
+    }
+    if (strcmp(name, "direct") == 0) {
+        return CONV_DIRECT;
+    }
+    if (strcmp(name, "separable") == 0) {
+        return CONV_SEPARABLE;
+    }
+    if (strcmp(name, "fft") == 0) {
+        return CONV_FFT;
+    }
+    fprintf(stderr, "invalid convolution: %s\n", name);
+    exit(1);
+}
+
+// the next whitespace separated word of a kernel file, skipping # comments;
+// returns 0 at the end of the file
+static int nextToken(FILE *filePointer, char *token) {
+    int c = fgetc(filePointer);
+    int length = 0;
+
+    for (;;) {
+        while (c != EOF && isspace(c)) {
+            c = fgetc(filePointer);
+        }
+        if (c != '#') {
+            break;
+        }
+        while (c != EOF && c != '\n') {
+            c = fgetc(filePointer);
+        }
+    }
+    while (c != EOF && !isspace(c) && c != '#' && length < TOKEN_MAX - 1) {
+        token[length++] = (char)c;
+        c = fgetc(filePointer);
+    }
+    if (c == '#') {
+        ungetc(c, filePointer);
+    }
+    token[length] = '\0';
+    return length > 0;
+}
+
+// a weight, 0 with the reason in error when the token is not an int
+static int parseWeight(const char *fileName, const char *token, int *value,
+    char *error, size_t errorSize) {
+    char *end;
+    long number = strtol(token, &end, 10);
+
+    if (*end != '\0' || number < INT_MIN || number > INT_MAX) {
+        snprintf(error, errorSize, "%s: weights must be integers, scale "
+            "them with the divisor: %s", fileName, token);
+        return 0;
+    }
+    *value = (int)number;
+    return 1;
+}
+
+static int greatestDivisor(int a, int b) {
+    while (b != 0) {
+        int rest = a % b;
+        a = b;
+        b = rest;
+    }
+    return a < 0 ? -a : a;
+}
+
+// split the weights into an integer column times an integer row when the
+// kernel has rank 1; returns 0 when it does not
+static int factorize(convolution *conv) {
+    int size = conv->size;
+    const int *weights = conv->weights;
+    int pivotRow = 0, pivotColumn = 0;
+
+    for (int i = 0; i < size * size; i++) {
+        if (abs(weights[i]) > abs(weights[pivotRow * size + pivotColumn])) {
+            pivotRow = i / size;
+            pivotColumn = i % size;
+        }
+    }
+    long long pivot = weights[pivotRow * size + pivotColumn];
+    if (pivot == 0) {
+        return 0;
+    }
+    // rank 1: every 2x2 minor through the pivot vanishes
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            if (weights[i * size + j] * pivot != (long long)weights[i * size +
+                pivotColumn] * weights[pivotRow * size + j]) {
+                return 0;
+            }
+        }
+    }
+
+    // the pivot row over the gcd of its weights, the column follows
+    int divisor = 0;
+    for (int j = 0; j < size; j++) {
+        divisor = greatestDivisor(divisor, weights[pivotRow * size + j]);
+    }
+    for (int j = 0; j < size; j++) {
+        conv->row[j] = weights[pivotRow * size + j] / divisor;
+    }
+    for (int i = 0; i < size; i++) {
+        if (weights[i * size + pivotColumn] % conv->row[pivotColumn] != 0) {
+            return 0;
+        }
+        conv->column[i] = weights[i * size + pivotColumn] /
+            conv->row[pivotColumn];
+    }
+    for (int i = 0; i < size * size; i++) {
+        if (conv->column[i / size] * conv->row[i % size] != weights[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// in place radix 2 transform of n complex samples, the inverse one without
+// the 1 / n
+static void transform(double *data, int n, const double *twiddles,
+    int inverse) {
+    // bit reversed order first
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            double *a = data + 2 * i;
+            double *b = data + 2 * j;
+            double real = a[0], imaginary = a[1];
+            a[0] = b[0];
+            a[1] = b[1];
+            b[0] = real;
+            b[1] = imaginary;
+        }
+    }
+
+    for (int length = 2; length <= n; length <<= 1) {
+        int half = length / 2;
+        int jump = n / length;
+        for (int start = 0; start < n; start += length) {
+            for (int k = 0; k < half; k++) {
+                double wr = twiddles[2 * k * jump];
+                double wi = inverse ? -twiddles[2 * k * jump + 1] :
+                    twiddles[2 * k * jump + 1];
+                double *a = data + 2 * (start + k);
+                double *b = data + 2 * (start + k + half);
+                double tr = b[0] * wr - b[1] * wi;
+                double ti = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+}
+
+static void transpose(double *data, int n) {
+    for (int i = 0; i < n; i++) {
+        for (int j = i + 1; j < n; j++) {
+            double *a = data + 2 * (i * n + j);
+            double *b = data + 2 * (j * n + i);
+            double real = a[0], imaginary = a[1];
+            a[0] = b[0];
+            a[1] = b[1];
+            b[0] = real;
+            b[1] = imaginary;
+        }
+    }
+}
+
+// every row, then every column of an n x n block; the columns go through
+// as rows of the transposed block, a column stride of a power of two
+// would keep hitting the same cache sets. The result stays transposed,
+// the inverse transform of a transposed block turns it back; only the
+// first rows rows of the result are transformed
+static void transformBlock(double *data, int n, int rows,
+    const double *twiddles, int inverse) {
+    for (int i = 0; i < n; i++) {
+        transform(data + 2 * i * n, n, twiddles, inverse);
+    }
+    transpose(data, n);
+    for (int i = 0; i < rows; i++) {
+        transform(data + 2 * i * n, n, twiddles, inverse);
+    }
+}
+
+// the spectrum a block is multiplied with: conjugate, so the product is a
+// correlation like the 3x3 filters, and scaled by the inverse 1 / n^2
+static void prepareSpectrum(convolution *conv) {
+    int n = conv->fftSize;
+    int size = conv->size;
+
+    conv->twiddles = (double *)malloc(n * sizeof(double));
+    conv->spectrum = (double *)calloc(2 * n * n, sizeof(double));
+    if (conv->twiddles == NULL || conv->spectrum == NULL) {
+        perror("error allocating kernel spectrum");
+        exit(1);
+    }
+    for (int k = 0; k < n / 2; k++) {
+        conv->twiddles[2 * k] = cos(2 * M_PI * k / n);
+        conv->twiddles[2 * k + 1] = -sin(2 * M_PI * k / n);
+    }
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            conv->spectrum[2 * (i * n + j)] = conv->weights[i * size + j];
+        }
+    }
+    transformBlock(conv->spectrum, n, n, conv->twiddles, 0);
+    for (int k = 0; k < n * n; k++) {
+        conv->spectrum[2 * k] /= (double)n * n;
+        conv->spectrum[2 * k + 1] /= -(double)n * n;
+    }
+}
+
+// cost of one output sample through blocks of side n, two blocks per
+// complex transform
+static double fftCost(int n, int radius) {
+    int block = n - 2 * radius;
+    int levels = 0;
+
+    for (int i = n; i > 1; i >>= 1) {
+        levels++;
+    }
+    // a forward and an inverse transform, each n rows and n columns
+    double butterflies = 2.0 * 2 * n * (n / 2) * levels;
+    return (butterflies * FFT_BUTTERFLY_COST + n * n * FFT_SAMPLE_COST) /
+        (2.0 * block * block);
+}
+
+// pick the path the cost model or the command line asks for
+static void chooseMethod(convolution *conv) {
+    int size = conv->size;
+    int taps = 0, columnTaps = 0, rowTaps = 0;
+
+    for (int i = 0; i < size * size; i++) {
+        taps += conv->weights[i] != 0;
+    }
+    for (int i = 0; conv->separable && i < size; i++) {
+        columnTaps += conv->column[i] != 0;
+        rowTaps += conv->row[i] != 0;
+    }
+
+    // the cheapest block size for the fft
+    conv->fftSize = 0;
+    double fft = 0;
+    for (int n = MIN_FFT_SIZE; n <= MAX_FFT_SIZE; n *= 2) {
+        if (n - 2 * conv->radius < n / 4) {  // too little of a block is output
+            continue;
+        }
+        if (conv->fftSize == 0 || fftCost(n, conv->radius) < fft) {
+            conv->fftSize = n;
+            fft = fftCost(n, conv->radius);
+        }
+    }
+
+    double tap = tapCost[activeIsa()];
+    double direct = taps * tap + DIRECT_STORE_COST;
+    double separable = (columnTaps + rowTaps) * tap + SEPARABLE_PASS_COST +
+        DIRECT_STORE_COST;
+    conv->method = CONV_DIRECT;
+    if (selectedMethod == CONV_AUTO) {
+        double best = direct;
+        if (conv->separable && separable < best) {
+            conv->method = CONV_SEPARABLE;
+            best = separable;
+        }
+        if (conv->fftSize > 0 && fft < best) {
+            conv->method = CONV_FFT;
+        }
+    } else if (selectedMethod == CONV_SEPARABLE && conv->separable) {
+        conv->method = CONV_SEPARABLE;
+    } else if (selectedMethod == CONV_FFT && conv->fftSize > 0) {
+        conv->method = CONV_FFT;
+    }
+
+    if (conv->method == CONV_FFT) {
+        prepareSpectrum(conv);
+    }
+}
+
+int readConvolution(const char *fileName, convolution *conv, char *error,
+    size_t errorSize) {
+    FILE *filePointer = fopen(fileName, "r");
+    char token[TOKEN_MAX];
+
+    memset(conv, 0, sizeof(*conv));
+    if (filePointer == NULL) {
+        snprintf(error, errorSize, "error opening kernel file %s: %s",
+            fileName, strerror(errno));
+        return 0;
+    }
+    if (!nextToken(filePointer, token)) {
+        snprintf(error, errorSize, "%s: empty kernel file", fileName);
+        fclose(filePointer);
+        return 0;
+    }
+    if (!parseWeight(fileName, token, &conv->size, error, errorSize)) {
+        fclose(filePointer);
+        return 0;
+    }
+    if (conv->size < MIN_KERNEL_SIZE || conv->size > MAX_KERNEL_SIZE ||
+        conv->size % 2 == 0) {
+        snprintf(error, errorSize, "%s: kernel side must be odd, from %d to "
+            "%d", fileName, MIN_KERNEL_SIZE, MAX_KERNEL_SIZE);
+        fclose(filePointer);
+        return 0;
+    }
+    conv->radius = conv->size / 2;
+
+    int taps = conv->size * conv->size;
+    conv->weights = (int *)malloc(taps * sizeof(int));
+    conv->column = (int *)malloc(conv->size * sizeof(int));
+    conv->row = (int *)malloc(conv->size * sizeof(int));
+    long long total = 0;
+    int valid = 1;
+    for (int i = 0; i < taps && valid; i++) {
+        if (!nextToken(filePointer, token)) {
+            snprintf(error, errorSize, "%s: %d weights expected", fileName,
+                taps);
+            valid = 0;
+        } else {
+            valid = parseWeight(fileName, token, &conv->weights[i], error,
+                errorSize);
+            total += llabs((long long)conv->weights[i]);
+        }
+    }
+    conv->divisor = 1;
+    if (valid && nextToken(filePointer, token)) {
+        valid = parseWeight(fileName, token, &conv->divisor, error,
+            errorSize);
+    }
+    if (valid && (conv->divisor < 1 || nextToken(filePointer, token))) {
+        snprintf(error, errorSize, "%s: a positive divisor is all that may "
+            "follow the weights", fileName);
+        valid = 0;
+    }
+    fclose(filePointer);
+
+    // every sum of weighted samples has to fit in an int
+    if (valid && total * 255 > INT_MAX) {
+        snprintf(error, errorSize, "%s: weights too large", fileName);
+        valid = 0;
+    }
+    if (!valid) {
+        freeConvolution(conv);
+        memset(conv, 0, sizeof(*conv));
+        return 0;
+    }
+    conv->separable = factorize(conv);
+    chooseMethod(conv);
+    return 1;
+}
+
+void loadConvolution(const char *fileName, convolution *conv) {
+    char error[CONV_ERROR_MAX];
+
+    if (!readConvolution(fileName, conv, error, sizeof(error))) {
+        fprintf(stderr, "%s\n", error);
+        exit(1);
+    }
+}
+
+void freeConvolution(convolution *conv) {
+    free(conv->weights);
+    free(conv->column);
+    free(conv->row);
+    free(conv->twiddles);
+    free(conv->spectrum);
+}
+
+// exact sums to samples: divided, truncated toward zero and wrapped
+static void storeSums(unsigned char *out, const int *sums, int count,
+    int divisor) {
+    int shift = 0;
+
+    while (shift < 30 && (1 << shift) < divisor) {
+        shift++;
+    }
+    if ((1 << shift) == divisor) {
+        // a shift rounds down, so negative sums are moved up first
+        for (int x = 0; x < count; x++) {
+            out[x] = (unsigned char)((sums[x] + ((sums[x] >> 31) &
+                (divisor - 1))) >> shift);
+        }
+        return;
+    }
+    for (int x = 0; x < count; x++) {
+        out[x] = (unsigned char)(sums[x] / divisor);
+    }
+}
+
+// copy the rows within radius of the image top and bottom and the radius
+// pixels at both ends of the others; earlier passes with a smaller radius
+// may have written them in dst
+static void copyEdges(image *dst, const image *src, int rowLow, int rowHigh,
+    int radius) {
+    int edge = radius * src->step < src->rowSamples ?
+        radius * src->step : src->rowSamples;
+
+    for (int p = 0; p < src->planes; p++) {
+        for (int line = rowLow; line < rowHigh; line++) {
+            unsigned char *out = imageRow(dst, p, line);
+            const unsigned char *in = imageRow(src, p, line);
+
+            if (line < radius || line >= src->height - radius) {
+                memcpy(out, in, src->rowSamples);
+                continue;
+            }
+            memcpy(out, in, edge);
+            memcpy(out + src->rowSamples - edge, in + src->rowSamples - edge,
+                edge);
+        }
+    }
+}
+
+// every tap on every sample of the rows [first, last)
+static void convolveDirect(image *dst, const image *src, int first, int last,
+    const convolution *conv) {
+    accumulateBytesKernel accumulate = byteKernels[activeIsa()];
+    int radius = conv->radius;
+    int step = src->step;
+    int sums[CHUNK_SAMPLES];
+
+    for (int p = 0; p < src->planes; p++) {
+        for (int line = first; line < last; line++) {
+            for (int x0 = radius * step; x0 < src->rowSamples - radius * step;
+                x0 += CHUNK_SAMPLES) {
+                int count = src->rowSamples - radius * step - x0;
+                count = count < CHUNK_SAMPLES ? count : CHUNK_SAMPLES;
+
+                memset(sums, 0, count * sizeof(int));
+                for (int dy = -radius; dy <= radius; dy++) {
+                    const unsigned char *in = imageRow(src, p, line + dy) + x0;
+                    const int *weights = conv->weights + (dy + radius) *
+                        conv->size + radius;
+                    for (int dx = -radius; dx <= radius; dx++) {
+                        if (weights[dx] != 0) {
+                            accumulate(sums, in + dx * step, count,
+                                weights[dx]);
+                        }
+                    }
+                }
+                storeSums(imageRow(dst, p, line) + x0, sums, count,
+                    conv->divisor);
+            }
+        }
+    }
+}
+
+// the row weights on every line, then the column weights over a ring of
+// the last size row sums, one chunk of samples at a time
+static void convolveSeparable(image *dst, const image *src, int first,
+    int last, const convolution *conv) {
+    accumulateBytesKernel accumulateBytes = byteKernels[activeIsa()];
+    accumulateIntsKernel accumulateInts = intKernels[activeIsa()];
+    int radius = conv->radius;
+    int size = conv->size;
+    int step = src->step;
+    int sums[CHUNK_SAMPLES];
+    int *ring = (int *)malloc(size * CHUNK_SAMPLES * sizeof(int));
+
+    if (ring == NULL) {
+        perror("error allocating row sums");
+        exit(1);
+    }
+    for (int p = 0; p < src->planes; p++) {
+        for (int x0 = radius * step; x0 < src->rowSamples - radius * step;
+            x0 += CHUNK_SAMPLES) {
+            int count = src->rowSamples - radius * step - x0;
+            count = count < CHUNK_SAMPLES ? count : CHUNK_SAMPLES;
+
+            for (int line = first - radius; line < last + radius; line++) {
+                // the row sums of line, kept until the last output reading it
+                int *rowSums = ring + (line % size) * CHUNK_SAMPLES;
+                const unsigned char *in = imageRow(src, p, line) + x0;
+                memset(rowSums, 0, count * sizeof(int));
+                for (int dx = -radius; dx <= radius; dx++) {
+                    if (conv->row[dx + radius] != 0) {
+                        accumulateBytes(rowSums, in + dx * step, count,
+                            conv->row[dx + radius]);
+                    }
+                }
+
+                int output = line - radius;
+                if (output < first) {
+                    continue;
+                }
+                memset(sums, 0, count * sizeof(int));
+                for (int dy = -radius; dy <= radius; dy++) {
+                    if (conv->column[dy + radius] != 0) {
+                        accumulateInts(sums, ring + ((output + dy) % size) *
+                            CHUNK_SAMPLES, count, conv->column[dy + radius]);
+                    }
+                }
+                storeSums(imageRow(dst, p, output) + x0, sums, count,
+                    conv->divisor);
+            }
+        }
+    }
+    free(ring);
+}
+
+// one block of output pixels of one channel
+typedef struct {
+    int plane;
+    int channel;
+    int row;  // first output row and pixel
+    int column;
+    int rows;  // output rows and pixels, at most the block side
+    int columns;
+}fftBlock;
+
+// the input of a block: its output and radius more on every side, zeros
+// past what exists; part 0 is the real, part 1 the imaginary part
+static void loadBlock(double *data, int n, int part, const image *src,
+    const fftBlock *block, int radius) {
+    int step = src->step;
+
+    for (int i = 0; i < block->rows + 2 * radius; i++) {
+        const unsigned char *in = imageRow(src, block->plane,
+            block->row - radius + i) + (block->column - radius) * step +
+            block->channel;
+        double *out = data + 2 * i * n + part;
+        for (int j = 0; j < block->columns + 2 * radius; j++) {
+            out[2 * j] = in[j * step];
+        }
+    }
+}
+
+static void storeBlock(image *dst, const double *data, int n, int part,
+    const fftBlock *block, int divisor) {
+    int step = dst->step;
+    int sums[MAX_FFT_SIZE];
+    unsigned char samples[MAX_FFT_SIZE];
+
+    for (int i = 0; i < block->rows; i++) {
+        unsigned char *out = imageRow(dst, block->plane, block->row + i) +
+            block->column * step + block->channel;
+        const double *in = data + 2 * i * n + part;
+        // every sum is an integer, the transforms are far more exact than 1/2
+        for (int j = 0; j < block->columns; j++) {
+            sums[j] = (int)floor(in[2 * j] + 0.5);
+        }
+        storeSums(samples, sums, block->columns, divisor);
+        for (int j = 0; j < block->columns; j++) {
+            out[j * step] = samples[j];
+        }
+    }
+}
+
+// the blocks of output pixels of the rows [first, last), in pairs through
+// one complex transform: one block in the real part, the next in the
+// imaginary part; every output only reads inputs of its own block, so the
+// circular products need no overlap between blocks
+static void convolveFft(image *dst, const image *src, int first, int last,
+    const convolution *conv) {
+    int n = conv->fftSize;
+    int radius = conv->radius;
+    int side = n - 2 * radius;
+    int width = src->rowSamples / src->step;  // pixels in a row of a plane
+    int blockRows = (last - first + side - 1) / side;
+    int blockColumns = (width - 2 * radius + side - 1) / side;
+    int perChannel = blockRows * blockColumns;
+    int count = src->planes * src->step * perChannel;
+    double *data = (double *)malloc(2 * n * n * sizeof(double));
+
+    if (data == NULL) {
+        perror("error allocating fft block");
+        exit(1);
+    }
+    for (int b = 0; b < count; b += 2) {
+        fftBlock blocks[2];
+        int pair = b + 1 < count ? 2 : 1;
+
+        memset(data, 0, 2 * n * n * sizeof(double));
+        for (int k = 0; k < pair; k++) {
+            int index = (b + k) % perChannel;
+            fftBlock *block = &blocks[k];
+
+            block->plane = (b + k) / perChannel / src->step;
+            block->channel = (b + k) / perChannel % src->step;
+            block->row = first + index / blockColumns * side;
+            block->column = radius + index % blockColumns * side;
+            block->rows = last - block->row < side ? last - block->row : side;
+            block->columns = width - radius - block->column < side ?
+                width - radius - block->column : side;
+            loadBlock(data, n, k, src, block, radius);
+        }
+
+        transformBlock(data, n, n, conv->twiddles, 0);
+        for (int k = 0; k < n * n; k++) {
+            double real = data[2 * k];
+            double imaginary = data[2 * k + 1];
+            data[2 * k] = real * conv->spectrum[2 * k] -
+                imaginary * conv->spectrum[2 * k + 1];
+            data[2 * k + 1] = real * conv->spectrum[2 * k + 1] +
+                imaginary * conv->spectrum[2 * k];
+        }
+        // the rows past the output ones are wrapped around, never read
+        transformBlock(data, n, side, conv->twiddles, 1);
+
+        for (int k = 0; k < pair; k++) {
+            storeBlock(dst, data, n, k, &blocks[k], conv->divisor);
+        }
+    }
+    free(data);
+}
+
+void convolveRows(image *dst, const image *src, int rowLow, int rowHigh,
+    const convolution *conv) {
+    int radius = conv->radius;
+    int first = rowLow > radius ? rowLow : radius;
+    int last = rowHigh < src->height - radius ? rowHigh : src->height - radius;
+
+    copyEdges(dst, src, rowLow, rowHigh, radius);
+    if (first >= last || src->rowSamples <= 2 * radius * src->step) {
+        return;  // all of it is edge
+    }
+    if (conv->method == CONV_FFT) {
+        convolveFft(dst, src, first, last, conv);
+    } else if (conv->method == CONV_SEPARABLE) {
+        convolveSeparable(dst, src, first, last, conv);
+    } else {
+        convolveDirect(dst, src, first, last, conv);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef CONVOLVE_H
+#define CONVOLVE_H
+
+#include "image.h"
+
+// how a kernel file is applied
+#define CONV_AUTO -1  // the cheapest path for the kernel, by the cost model
+#define CONV_DIRECT 0  // every tap on every sample
+#define CONV_SEPARABLE 1  // a column pass and a row pass, rank 1 kernels only
+#define CONV_FFT 2  // products of spectra, block by block
+
+#define MIN_KERNEL_SIZE 3
+#define MAX_KERNEL_SIZE 31
+#define CONV_ERROR_MAX 256  // longest reason readConvolution gives
+
+// a kernel of integer weights with a divisor; every output is the exact
+// sum of the weighted samples divided by the divisor and truncated toward
+// zero, wrapping outside 0..255 like the 3x3 filters, so all three paths
+// give the same pixels
+typedef struct {
+    int size;  // odd side of the square
+    int radius;  // rows and columns read past an output sample
+    int divisor;
+    int *weights;  // size x size, top row first, applied as laid out
+    int *column;  // weights = column x row, when separable
+    int *row;
+    int separable;
+    int method;  // CONV_DIRECT, CONV_SEPARABLE or CONV_FFT
+    int fftSize;  // side of the FFT blocks
+    double *twiddles;  // fftSize / 2 complex roots of unity
+    double *spectrum;  // conjugate spectrum of the kernel, over fftSize^2
+}convolution;
+
+// pick the path of every kernel loaded from now on, CONV_AUTO by default
+void selectConvolution(int method);
+int parseConvolution(const char *name);
+
+// load a kernel file: the side, the weights row by row, then an optional
+// divisor (1 if missing), # comments anywhere; returns 0 with the reason
+// in error on bad files
+int readConvolution(const char *fileName, convolution *conv, char *error,
+    size_t errorSize);
+// readConvolution, exiting on bad files
+void loadConvolution(const char *fileName, convolution *conv);
+void freeConvolution(convolution *conv);
+
+// convolve the rows [rowLow, rowHigh) of every plane of src into dst; the
+// samples within radius of the image edges are copied as they are
+void convolveRows(image *dst, const image *src, int rowLow, int rowHigh,
+    const convolution *conv);
+
+#endif
@@ -0,0 +1,414 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "encode.h"
+#include "bandio.h"
+#include "pnm.h"
+#include "profile.h"
+
+#define RAW_DEFLATE -MAX_WBITS  // no zlib or gzip wrapper, rank 0 adds it
+#define DEFLATE_MEMORY 8
+#define FLUSH_BYTES 16  // past deflateBound, for the sync flush marker
+#define ENCODE_HEADER_MAX 128
+
+#define PNG_CHUNK_PREFIX 8  // length and type
+#define PNG_CHUNK_BYTES 12  // with the crc
+#define PNG_FILTER_SUB 1  // every sample minus the one a pixel before
+#define PNG_GREY 0
+#define PNG_RGB 2
+#define ZLIB_METHOD 0x78  // deflate with a 32 KiB window
+
+// a final empty fixed block, ends the joined stream
+static const unsigned char lastBlock[2] = {0x03, 0x00};
+
+static const unsigned char pngSignature[8] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+};
+
+static const unsigned char gzipHeader[10] = {
+    0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3  // no name or time, unix
+};
+
+int outputFormat(const char *fileName) {
+    size_t length = strlen(fileName);
+
+    if (length > 4 && strcmp(fileName + length - 4, ".png") == 0) {
+        return FORMAT_PNG;
+    }
+    if (length > 3 && strcmp(fileName + length - 3, ".gz") == 0) {
+        return FORMAT_GZIP;
+    }
+    return FORMAT_PNM;
+}
+
+int parseCompression(const char *text) {
+    char *end;
+    long level = strtol(text, &end, 10);
+
+    if (*end != '\0' || end == text || level < Z_NO_COMPRESSION ||
+        level > Z_BEST_COMPRESSION) {
+        fprintf(stderr, "invalid compression level: %s\n", text);
+        exit(1);
+    }
+    return (int)level;
+}
+
+static void putBig(unsigned char *bytes, unsigned long value) {
+    bytes[0] = (unsigned char)(value >> 24);
+    bytes[1] = (unsigned char)(value >> 16);
+    bytes[2] = (unsigned char)(value >> 8);
+    bytes[3] = (unsigned char)value;
+}
+
+static void putLittle(unsigned char *bytes, unsigned long value) {
+    bytes[0] = (unsigned char)value;
+    bytes[1] = (unsigned char)(value >> 8);
+    bytes[2] = (unsigned char)(value >> 16);
+    bytes[3] = (unsigned char)(value >> 24);
+}
+
+// wrap the size bytes at chunk + PNG_CHUNK_PREFIX in a chunk of type,
+// returns the bytes of the whole chunk
+static size_t closeChunk(unsigned char *chunk, const char *type, size_t size) {
+    putBig(chunk, size);
+    memcpy(chunk + 4, type, 4);
+    putBig(chunk + PNG_CHUNK_PREFIX + size,
+        crc32(crc32(0, NULL, 0), chunk + 4, size + 4));
+    return size + PNG_CHUNK_BYTES;
+}
+
+// zlib keeps a pointer to the stream, so it stays where it starts
+static void startDeflate(z_stream *stream, int level) {
+    memset(stream, 0, sizeof(z_stream));
+    if (deflateInit2(stream, level, Z_DEFLATED, RAW_DEFLATE, DEFLATE_MEMORY,
+        Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "error starting deflate\n");
+        exit(1);
+    }
+}
+
+static void deflateInput(z_stream *stream, const unsigned char *bytes,
+    size_t size, int flush) {
+    stream->next_in = (Bytef *)bytes;
+    stream->avail_in = (uInt)size;
+    if (deflate(stream, flush) == Z_STREAM_ERROR || stream->avail_in != 0 ||
+        stream->avail_out == 0) {
+        fprintf(stderr, "error deflating output\n");
+        exit(1);
+    }
+}
+
+void startEncoder(bandEncoder *enc, const image *shape, int rowLow,
+    int rowHigh, int format, int level, int threads, MPI_Comm comm) {
+    if (format == FORMAT_PNG && shape->maxval != PNM_MAXVAL_8BIT) {
+        fprintf(stderr, "PNG output needs a maxval of %d, not %d\n",
+            PNM_MAXVAL_8BIT, shape->maxval);
+        MPI_Abort(comm, 1);
+    }
+
+    enc->shape = *shape;
+    enc->shape.data = NULL;
+    enc->format = format;
+    enc->level = level;
+    enc->rowLow = rowLow;
+    enc->rowHigh = rowHigh;
+    enc->source = NULL;
+    enc->threads = threads > 0 ? threads : 1;
+
+    // pigz sized blocks, smaller when the band would leave threads idle
+    int rows = rowHigh - rowLow;
+    size_t rowBytes = fileRowBytes(shape);
+    int stripeRows = ENCODE_STRIPE_BYTES / rowBytes > 0 ?
+        (int)(ENCODE_STRIPE_BYTES / rowBytes) : 1;
+    int shareRows = (rows + enc->threads - 1) / enc->threads;
+    if (shareRows > 0 && shareRows < stripeRows) {
+        stripeRows = shareRows;
+    }
+    enc->stripeRows = stripeRows;
+    enc->stripeCount = (rows + stripeRows - 1) / stripeRows;
+
+    int count = enc->stripeCount > 0 ? enc->stripeCount : 1;
+    enc->stripes = (unsigned char **)calloc(count, sizeof(unsigned char *));
+    enc->stripeSizes = (size_t *)calloc(count, sizeof(size_t));
+    enc->checks = (unsigned long *)calloc(count, sizeof(unsigned long));
+    enc->rawSizes = (size_t *)calloc(count, sizeof(size_t));
+    enc->seconds = (double *)calloc(enc->threads, sizeof(double));
+}
+
+void encodeStripe(bandEncoder *enc, const image *img, int stripe, int thread) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int low = enc->rowLow + stripe * enc->stripeRows;
+    int high = low + enc->stripeRows < enc->rowHigh ?
+        low + enc->stripeRows : enc->rowHigh;
+    int png = enc->format == FORMAT_PNG;
+    int bpp = img->channels;
+    size_t rowBytes = fileRowBytes(img);
+    size_t rawRow = rowBytes + (png ? 1 : 0);  // PNG rows lead with a filter
+    size_t prefix = png ? PNG_CHUNK_PREFIX : 0;
+
+    // a stripe of PNG becomes an IDAT chunk of its own
+    z_stream stream;
+    startDeflate(&stream, enc->level);
+    size_t bound = deflateBound(&stream, rawRow * (high - low)) + FLUSH_BYTES;
+    unsigned char *out = (unsigned char *)malloc(prefix + bound +
+        PNG_CHUNK_BYTES);
+    unsigned char *scratch = (unsigned char *)malloc(rowBytes + rawRow);
+    unsigned long check = png ? adler32(0, NULL, 0) : crc32(0, NULL, 0);
+    stream.next_out = out + prefix;
+    stream.avail_out = (uInt)bound;
+
+    // one row at a time, straight from the padded rows when interleaved
+    for (int row = low; row < high; row++) {
+        const unsigned char *pixels = imageRow(img, 0, row);
+        if (img->layout == PLANAR && img->channels > 1) {
+            interleaveRow(img, row, scratch);
+            pixels = scratch;
+        }
+        const unsigned char *raw = pixels;
+        if (png) {
+            unsigned char *filtered = scratch + rowBytes;
+            filtered[0] = PNG_FILTER_SUB;
+            memcpy(filtered + 1, pixels, bpp);
+            for (size_t i = bpp; i < rowBytes; i++) {
+                filtered[1 + i] = (unsigned char)(pixels[i] - pixels[i - bpp]);
+            }
+            raw = filtered;
+        }
+        check = png ? adler32(check, raw, rawRow) : crc32(check, raw, rawRow);
+        deflateInput(&stream, raw, rawRow,
+            row == high - 1 ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+    }
+    size_t size = bound - stream.avail_out;
+    deflateEnd(&stream);
+    free(scratch);
+
+    enc->stripes[stripe] = out;
+    enc->stripeSizes[stripe] = png ? closeChunk(out, "IDAT", size) : size;
+    enc->checks[stripe] = check;
+    enc->rawSizes[stripe] = rawRow * (high - low);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    enc->seconds[thread] += (end.tv_sec - start.tv_sec) +
+        (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+void encodeTask(void *arg, int thread, int threads) {
+    bandEncoder *enc = (bandEncoder *)arg;
+    int first, last;
+
+    splitRange(0, enc->stripeCount, thread, threads, &first, &last);
+    for (int stripe = first; stripe < last; stripe++) {
+        encodeStripe(enc, enc->source, stripe, thread);
+    }
+}
+
+// the signature, IHDR and an IDAT chunk holding the zlib header
+static size_t pngHeader(const bandEncoder *enc, unsigned char *header) {
+    size_t size = 0;
+
+    memcpy(header, pngSignature, sizeof(pngSignature));
+    size += sizeof(pngSignature);
+
+    unsigned char *data = header + size + PNG_CHUNK_PREFIX;
+    putBig(data, enc->shape.width);
+    putBig(data + 4, enc->shape.height);
+    data[8] = 8;  // bits per sample
+    data[9] = enc->shape.channels == IMAGE_SIZE_COL ? PNG_RGB : PNG_GREY;
+    data[10] = 0;  // deflate
+    data[11] = 0;  // adaptive filters, one per row
+    data[12] = 0;  // not interlaced
+    size += closeChunk(header + size, "IHDR", 13);
+
+    // the level hint of the zlib header, then the check bits
+    int hint = enc->level < 2 ? 0 : enc->level < 6 ? 1 : enc->level == 6 ? 2 : 3;
+    data = header + size + PNG_CHUNK_PREFIX;
+    data[0] = ZLIB_METHOD;
+    data[1] = (unsigned char)(hint << 6);
+    data[1] += 31 - (data[0] * 256 + data[1]) % 31;
+    size += closeChunk(header + size, "IDAT", 2);
+    return size;
+}
+
+// the gzip header, then the PNM header deflated on its own
+static size_t gzipStart(const bandEncoder *enc, unsigned char *header,
+    unsigned long *check, size_t *rawSize) {
+    char pnmHeader[HEADER_MAX];
+    int pnmSize = formatHeader(&enc->shape, pnmHeader);
+
+    memcpy(header, gzipHeader, sizeof(gzipHeader));
+    z_stream stream;
+    startDeflate(&stream, enc->level);
+    stream.next_out = header + sizeof(gzipHeader);
+    stream.avail_out = ENCODE_HEADER_MAX - sizeof(gzipHeader);
+    deflateInput(&stream, (const unsigned char *)pnmHeader, pnmSize,
+        Z_SYNC_FLUSH);
+    size_t size = ENCODE_HEADER_MAX - stream.avail_out;
+    deflateEnd(&stream);
+
+    *check = crc32(crc32(0, NULL, 0), (const unsigned char *)pnmHeader,
+        pnmSize);
+    *rawSize = pnmSize;
+    return size;
+}
+
+// the last block, then the check of the whole stream
+static size_t encodedTrailer(int format, unsigned long check, size_t rawSize,
+    unsigned char *trailer) {
+    if (format == FORMAT_GZIP) {
+        memcpy(trailer, lastBlock, sizeof(lastBlock));
+        putLittle(trailer + 2, check);
+        putLittle(trailer + 6, (unsigned long)rawSize);
+        return 10;
+    }
+
+    unsigned char *data = trailer + PNG_CHUNK_PREFIX;
+    memcpy(data, lastBlock, sizeof(lastBlock));
+    putBig(data + 2, check);
+    size_t size = closeChunk(trailer, "IDAT", 6);
+    return size + closeChunk(trailer + size, "IEND", 0);
+}
+
+void writeEncoded(const char *fileName, bandEncoder *enc, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int png = enc->format == FORMAT_PNG;
+
+    // the stripes of this rank as one piece, the threads deflated in
+    // parallel so the slowest one counts
+    long pieceSize = 0;
+    unsigned long piece[2] = {png ? adler32(0, NULL, 0) : crc32(0, NULL, 0), 0};
+    double deflating = 0;
+    for (int s = 0; s < enc->stripeCount; s++) {
+        pieceSize += enc->stripeSizes[s];
+        piece[0] = png ?
+            adler32_combine(piece[0], enc->checks[s], enc->rawSizes[s]) :
+            crc32_combine(piece[0], enc->checks[s], enc->rawSizes[s]);
+        piece[1] += enc->rawSizes[s];
+    }
+    for (int t = 0; t < enc->threads; t++) {
+        deflating = enc->seconds[t] > deflating ? enc->seconds[t] : deflating;
+    }
+    profilePhase(PHASE_ENCODE, profileBegin() - deflating, pieceSize);
+    double begin = profileBegin();
+
+    // rank 0 leads with the header, every piece follows in rank order
+    unsigned char header[ENCODE_HEADER_MAX];
+    size_t headerSize = 0;
+    unsigned long check = 0;
+    size_t rawSize = 0;
+    if (rank == 0 && png) {
+        headerSize = pngHeader(enc, header);
+        check = adler32(0, NULL, 0);
+    } else if (rank == 0) {
+        headerSize = gzipStart(enc, header, &check, &rawSize);
+    }
+    long mine = (long)headerSize + pieceSize;
+    long offset = 0;
+    long total = 0;
+    MPI_Exscan(&mine, &offset, 1, MPI_LONG, MPI_SUM, comm);
+    MPI_Reduce(&mine, &total, 1, MPI_LONG, MPI_SUM, 0, comm);
+    unsigned long *pieces = rank == 0 ?
+        (unsigned long *)malloc(2 * size * sizeof(unsigned long)) : NULL;
+    MPI_Gather(piece, 2, MPI_UNSIGNED_LONG, pieces, 2, MPI_UNSIGNED_LONG, 0,
+        comm);
+
+    int fd = -1;
+    if (rank == 0) {
+        offset = 0;
+        fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror("error opening output file");
+            MPI_Abort(comm, 1);
+        }
+        writeFully(fd, header, headerSize);
+    }
+    MPI_Barrier(comm);  // the file exists, every rank writes its piece
+    if (rank != 0 && pieceSize > 0) {
+        fd = open(fileName, O_WRONLY);
+        if (fd < 0 || lseek(fd, offset, SEEK_SET) < 0) {
+            perror("error opening output file");
+            MPI_Abort(comm, 1);
+        }
+    }
+    for (int s = 0; s < enc->stripeCount; s++) {
+        writeFully(fd, enc->stripes[s], enc->stripeSizes[s]);
+        free(enc->stripes[s]);
+    }
+
+    // the checks join in row order
+    if (rank == 0) {
+        for (int r = 0; r < size; r++) {
+            check = png ? adler32_combine(check, pieces[2 * r],
+                pieces[2 * r + 1]) : crc32_combine(check, pieces[2 * r],
+                pieces[2 * r + 1]);
+            rawSize += pieces[2 * r + 1];
+        }
+        unsigned char trailer[ENCODE_HEADER_MAX];
+        size_t trailerSize = encodedTrailer(enc->format, check, rawSize,
+            trailer);
+        if (lseek(fd, total, SEEK_SET) < 0) {
+            perror("error writing output file");
+            MPI_Abort(comm, 1);
+        }
+        writeFully(fd, trailer, trailerSize);
+        mine += trailerSize;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    profilePhase(PHASE_WRITE, begin, mine);
+
+    free(pieces);
+    free(enc->stripes);
+    free(enc->stripeSizes);
+    free(enc->checks);
+    free(enc->rawSizes);
+    free(enc->seconds);
+}
+
+void encodeFile(const char *raw, const char *output, const options *opts,
+    threadPool *pool, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // read back as bands, whichever way the mode split the image
+    image shape;
+    int rowLow, rowHigh;
+    long dataOffset = shareHeader(raw, &shape, opts->layout, comm);
+    computeBand(shape.height, rank, size, &rowLow, &rowHigh);
+    readBand(raw, &shape, dataOffset, rowLow, rowHigh - rowLow, opts->io,
+        comm);
+
+    bandEncoder enc;
+    startEncoder(&enc, &shape, rowLow, rowHigh, outputFormat(output),
+        opts->compression, pool->active, comm);
+    enc.source = &shape;
+    runPool(pool, encodeTask, &enc);
+    writeEncoded(output, &enc, comm);
+    freeImage(&shape);
+
+    MPI_Barrier(comm);
+    if (rank == 0) {
+        unlink(raw);
+    }
+}
+
+void compressedImage(const imageJob *job, const options *opts,
+    threadPool *pool, MPI_Comm comm) {
+    char raw[ENCODE_PATH_MAX];
+    snprintf(raw, ENCODE_PATH_MAX, "%s%s", job->output, RAW_SUFFIX);
+    imageJob rawJob = *job;
+    rawJob.output = raw;
+    processImage(&rawJob, opts, pool, comm);
+    MPI_Barrier(comm);  // every rank has written its rows
+    encodeFile(raw, job->output, opts, pool, comm);
+}
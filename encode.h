@@ -0,0 +1,69 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <mpi.h>
+
+#include "process.h"
+
+// what an output file name asks for
+#define FORMAT_PNM 0  // raw P5 or P6
+#define FORMAT_PNG 1  // .png, 8-bit grey or RGB
+#define FORMAT_GZIP 2  // .gz, the P5 or P6 file gzipped
+
+#define DEFAULT_COMPRESSION 6  // zlib level
+#define ENCODE_STRIPE_BYTES (256 << 10)  // samples deflated on their own
+#define RAW_SUFFIX ".raw"  // rows of the other modes, before encoding
+#define ENCODE_PATH_MAX 4096
+
+// the rows of a band cut in stripes, every stripe deflated on its own and
+// ended with a sync flush, so the stripes of every rank and thread join
+// into one deflate stream in row order
+typedef struct {
+    image shape;
+    int format;
+    int level;
+    int rowLow;
+    int rowHigh;
+    int stripeRows;
+    int stripeCount;
+    const image *source;  // the rows encodeTask deflates
+    unsigned char **stripes;  // the bytes of every stripe, ready to write
+    size_t *stripeSizes;
+    unsigned long *checks;  // adler32 for PNG, crc32 for gzip
+    size_t *rawSizes;  // bytes every check covers
+    double *seconds;  // spent deflating, per thread
+    int threads;
+}bandEncoder;
+
+// the format picked by the suffix of fileName
+int outputFormat(const char *fileName);
+int parseCompression(const char *text);
+
+// cut [rowLow, rowHigh) of an image shaped like shape in stripes, at least
+// one per thread when the band allows it
+void startEncoder(bandEncoder *enc, const image *shape, int rowLow,
+    int rowHigh, int format, int level, int threads, MPI_Comm comm);
+
+// deflate stripe index from the rows of img; any thread may run it, each
+// on its own stripes
+void encodeStripe(bandEncoder *enc, const image *img, int stripe, int thread);
+
+// deflate the stripes of enc->source, one share per thread
+void encodeTask(void *arg, int thread, int threads);
+
+// write every rank's stripes at their offset in one file, rank 0 adding
+// the header and the trailer that ends the deflate stream and holds the
+// combined check; frees the stripes
+void writeEncoded(const char *fileName, bandEncoder *enc, MPI_Comm comm);
+
+// encode the raw PNM file raw into output with every rank of comm, each
+// reading and deflating a band, then remove raw
+void encodeFile(const char *raw, const char *output, const options *opts,
+    threadPool *pool, MPI_Comm comm);
+
+// filter one image in a mode that writes raw rows: those rows go to a
+// temporary file next to the output, then every rank encodes its band
+void compressedImage(const imageJob *job, const options *opts,
+    threadPool *pool, MPI_Comm comm);
+
+#endif
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filters.h"
+#include "special.h"
+
+const float smoothingFilter[9] = {1.0 / 9, 1.0 / 9, 1.0 / 9,
+                                    1.0 / 9, 1.0 / 9, 1.0 / 9,
+                                    1.0 / 9, 1.0 / 9, 1.0 / 9};
+
+const float gaussBlurFilter[9] = {1.0 / 16, 2.0 / 16, 1.0 / 16,
+                                    2.0 / 16, 4.0 / 16, 2.0 / 16,
+                                    1.0 / 16, 2.0 / 16, 1.0 / 16};
+
+const float sharpenFilter[9] = {0, -2.0 / 3, 0,
+                                    -2.0 / 3, 11.0 / 3, -2.0 / 3,
+                                    0, -2.0 / 3, 0};
+
+const float meanRemovalFilter[9] = {-1, -1, -1, -1, 9, -1, -1, -1, -1};
+const float embossFilter[9] = {0, 1, 0, 0, 0, 0, 0, -1, 0};
+
+// one special kernel per isa; smooth keeps the vector kernels once there
+// are any, its exact fallback on multiples of 9 does not vectorize
+static const filterDef filters[] = {
+    {"smooth", smoothingFilter,
+        {smoothRowScalar, NULL, NULL, NULL}},
+    {"blur", gaussBlurFilter,
+        {blurRowScalar, blurRowSse41, blurRowAvx2, blurRowAvx512}},
+    {"sharpen", sharpenFilter,
+        {sharpenRowScalar, sharpenRowSse41, sharpenRowAvx2, sharpenRowAvx512}},
+    {"mean", meanRemovalFilter,
+        {meanRowScalar, meanRowSse41, meanRowAvx2, meanRowAvx512}},
+    {"emboss", embossFilter,
+        {embossRowScalar, embossRowSse41, embossRowAvx2, embossRowAvx512}},
+};
+
+#define FILTER_TABLE_SIZE ((int)(sizeof(filters) / sizeof(filters[0])))
+
+// a loaded kernel file and the version of the file it came from
+typedef struct {
+    filterDef def;  // first, so the filterDef handed out is the entry
+    convolution conv;
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+}kernelFile;
+
+// the kernel files loaded since the last releaseKernelFiles; one edited on
+// disk since it was loaded gets a new entry, the old one stays for the
+// chains that point at it
+static kernelFile **kernelFiles;
+static int kernelFileCount;
+static int kernelFileCapacity;
+
+// what the profile calls every kernel file
+static const filterDef kernelFileSlot = {"kernel files", NULL, {NULL}};
+
+const filterDef *lookupFilter(const char *name, char *error,
+    size_t errorSize) {
+    for (int i = 0; i < FILTER_TABLE_SIZE; i++) {
+        if (strcmp(name, filters[i].name) == 0) {
+            return &filters[i];
+        }
+    }
+    struct stat info;
+    if (stat(name, &info) != 0 || access(name, R_OK) != 0) {
+        snprintf(error, errorSize, "unknown filter: %s", name);
+        return NULL;
+    }
+    for (int i = 0; i < kernelFileCount; i++) {
+        kernelFile *file = kernelFiles[i];
+        if (strcmp(name, file->def.name) == 0 &&
+            file->device == info.st_dev && file->inode == info.st_ino &&
+            file->size == info.st_size &&
+            file->modified.tv_sec == info.st_mtim.tv_sec &&
+            file->modified.tv_nsec == info.st_mtim.tv_nsec) {
+            return &file->def;
+        }
+    }
+
+    kernelFile *file = (kernelFile *)calloc(1, sizeof(kernelFile));
+    if (!readConvolution(name, &file->conv, error, errorSize)) {
+        free(file);
+        return NULL;
+    }
+    file->def.name = strdup(name);
+    file->def.conv = &file->conv;
+    file->device = info.st_dev;
+    file->inode = info.st_ino;
+    file->size = info.st_size;
+    file->modified = info.st_mtim;
+    if (kernelFileCount == kernelFileCapacity) {
+        kernelFileCapacity = kernelFileCapacity > 0 ?
+            2 * kernelFileCapacity : 16;
+        kernelFiles = (kernelFile **)realloc(kernelFiles,
+            kernelFileCapacity * sizeof(kernelFile *));
+    }
+    kernelFiles[kernelFileCount++] = file;
+    return &file->def;
+}
+
+void releaseKernelFiles(void) {
+    for (int i = 0; i < kernelFileCount; i++) {
+        freeConvolution(&kernelFiles[i]->conv);
+        free((char *)kernelFiles[i]->def.name);
+        free(kernelFiles[i]);
+    }
+    kernelFileCount = 0;
+}
+
+const filterDef *findFilter(const char *name) {
+    char error[CONV_ERROR_MAX];
+    const filterDef *def = lookupFilter(name, error, sizeof(error));
+
+    if (def == NULL) {
+        fprintf(stderr, "%s\n", error);
+        exit(1);
+    }
+    return def;
+}
+
+int filterRadius(const filterDef *def) {
+    return def->conv != NULL ? def->conv->radius : 1;
+}
+
+int filterId(const filterDef *def) {
+    if (def->conv != NULL) {
+        return FILTER_TABLE_SIZE;
+    }
+    return (int)(def - filters);
+}
+
+const filterDef *filterById(int id) {
+    if (id == FILTER_TABLE_SIZE) {
+        return &kernelFileSlot;
+    }
+    if (id < 0 || id > FILTER_TABLE_SIZE) {
+        return NULL;
+    }
+    return &filters[id];
+}
+
+void prepareFilter(stencil *st, const filterDef *def) {
+    if (def->conv != NULL) {  // convolveRows needs no stencil
+        return;
+    }
+    rowKernel special = def->special[activeIsa()];
+
+    prepareStencil(st, def->weights);
+    if (special != NULL) {
+        st->kernel = special;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include "kernels.h"
+#include "convolve.h"
+
+typedef struct {
+    const char *name;
+    const float *weights;
+    // same pixels as the generic loop, written for the shape of the weights;
+    // one per isa, NULL to keep the generic vector kernel
+    rowKernel special[ISA_COUNT];
+    // a kernel file of any size, NULL for the 3x3 filters
+    const convolution *conv;
+}filterDef;
+
+extern const float smoothingFilter[STENCIL_TAPS];
+extern const float gaussBlurFilter[STENCIL_TAPS];
+extern const float sharpenFilter[STENCIL_TAPS];
+extern const float meanRemovalFilter[STENCIL_TAPS];
+extern const float embossFilter[STENCIL_TAPS];
+
+// look a filter up by its command line name, or load the kernel file of
+// that name, once per version of the file; NULL with the reason in error
+// on unknown names and bad kernel files
+const filterDef *lookupFilter(const char *name, char *error,
+    size_t errorSize);
+// lookupFilter, exiting on unknown names
+const filterDef *findFilter(const char *name);
+// free every kernel file loaded so far, once no chain points at them; the
+// server drops them after every job
+void releaseKernelFiles(void);
+
+// rows and columns a filter reads past an output pixel
+int filterRadius(const filterDef *def);
+
+// position of a filter in the table, the same on every rank; kernel files
+// all share the position past the table
+int filterId(const filterDef *def);
+
+// the filter at a table position, NULL past the end
+const filterDef *filterById(int id);
+
+// get a stencil ready for one pass of a filter, with its fastest kernel
+void prepareFilter(stencil *st, const filterDef *def);
+
+#endif
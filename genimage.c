@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// synthetic test images: gradients, hard edges and noise, the same bytes
+// for the same seed on every machine
+#define DEFAULT_SEED 1
+#define TILE 64  // side of the checkerboard squares
+
+static unsigned int nextRandom(unsigned int *state) {
+    // xorshift32
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [--seed n] pgm|pnm width height output\n",
+        program);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int seed = DEFAULT_SEED;
+    int first = 1;
+
+    if (argc > 2 && strcmp(argv[1], "--seed") == 0) {
+        seed = (unsigned int)strtoul(argv[2], NULL, 10);
+        first = 3;
+    }
+    if (argc - first != 4) {
+        usage(argv[0]);
+    }
+
+    int channels;
+    if (strcmp(argv[first], "pgm") == 0) {
+        channels = 1;
+    } else if (strcmp(argv[first], "pnm") == 0) {
+        channels = 3;
+    } else {
+        usage(argv[0]);
+    }
+    int width = atoi(argv[first + 1]);
+    int height = atoi(argv[first + 2]);
+    if (width < 1 || height < 1) {
+        usage(argv[0]);
+    }
+
+    FILE *filePointer = fopen(argv[first + 3], "wb");
+    if (filePointer == NULL) {
+        perror("error opening output file");
+        exit(1);
+    }
+    fprintf(filePointer, "P%d\n%d %d\n255\n", channels == 1 ? 5 : 6, width,
+        height);
+
+    unsigned int state = seed != 0 ? seed : DEFAULT_SEED;
+    size_t rowBytes = (size_t)width * channels;
+    unsigned char *row = (unsigned char *)malloc(rowBytes);
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            int square = ((i / TILE) + (j / TILE)) % 2 ? 96 : 0;
+            for (int c = 0; c < channels; c++) {
+                // a gradient per channel, the squares and some noise
+                int gradient = c == 1 ? i * 255 / height : j * 255 / width;
+                int noise = (int)(nextRandom(&state) % 32);
+                row[(size_t)j * channels + c] =
+                    (unsigned char)(gradient + square + noise);
+            }
+        }
+        if (fwrite(row, 1, rowBytes, filePointer) != rowBytes) {
+            perror("error writing output file");
+            exit(1);
+        }
+    }
+    free(row);
+    fclose(filePointer);
+    return 0;
+}
@@ -4,591 +4,263 @@
 #include <string.h>
 #include <math.h>
 
-#define IMAGE_SIZE_BW 1
-#define IMAGE_SIZE_COL 3
-#define BW 5
-#define COLOR 6
-#define UNDEFINED -1
+#include "image.h"
+#include "kernels.h"
+#include "filters.h"
+#include "pool.h"
+#include "bandio.h"
+#include "process.h"
+#include "batch.h"
+#include "stream.h"
+#include "steal.h"
+#include "pipeline.h"
+#include "cache.h"
+#include "encode.h"
+#include "tune.h"
+#include "server.h"
+#include "profile.h"
 
 #define FILTER_START 3
 #define FILTER_END argc
-
-#define LEADER_RANK 0
-
-typedef struct {
-    int type;  // store all data for any type of image
-    int width;
-    int height;
-    int maxval;
-    unsigned char** bwData;  // bw image case
-    unsigned char** redData;  // color image case
-    unsigned char** greenData;
-    unsigned char** blueData;
-}image;
-
-const float smoothingFilter[9] = {1.0 / 9, 1.0 / 9, 1.0 / 9,
-                                    1.0 / 9, 1.0 / 9, 1.0 / 9,
-                                    1.0 / 9, 1.0 / 9, 1.0 / 9};
-
-const float gaussBlurFilter[9] = {1.0 / 16, 2.0 / 16, 1.0 / 16,
-                                    2.0 / 16, 4.0 / 16, 2.0 / 16,
-                                    1.0 / 16, 2.0 / 16, 1.0 / 16};
-
-const float sharpenFilter[9] = {0, -2.0 / 3, 0,
-                                    -2.0 / 3, 11.0 / 3, -2.0 / 3,
-                                    0, -2.0 / 3, 0};
-
-const float meanRemovalFilter[9] = {-1, -1, -1, -1, 9, -1, -1, -1, -1};
-const float embossFilter[9] = {0, 1, 0, 0, 0, 0, 0, -1, 0};
-
-void readInput(const char * fileName, image *img) {
-    // open input file for reading
-    FILE *filePointer = fopen(fileName, "rb");
-    if (filePointer == NULL) {
-        perror("error opening input file");
-        exit(1);
-    }
-
-    // read image type in tempImageTypeBuffer
-    char tempImageType[3] = {'\0'};
-    fread(tempImageType, 1, 2,filePointer);
-    // read \n in junk
-    char junk[1];
-    fread(junk, 1, 1, filePointer);
-
-    // read image width in width buffer, then convert to integer widthAsNum
-    char width[10] = {'\0'};
-    int widthAsNum = -1;
-    int i = 0;
-    fread(junk, 1, 1, filePointer);
-    while(junk[0] != ' ') {
-        width[i] = junk[0];
-        i++;
-        fread(junk, 1, 1, filePointer);
-    }
-    widthAsNum = atoi(width);
-
-    // read image height in height buffer, then convert to integer heightAsNum
-    char height[10] = {'\0'};
-    int heightAsNum = -1;
-    i = 0;
-    fread(junk, 1, 1, filePointer);
-    while(junk[0] != '\n') {
-        height[i] = junk[0];
-        i++;
-        fread(junk, 1, 1, filePointer);
-    }
-    heightAsNum = atoi(height);
-
-    //read maxval in maxval buffer, then convert to integer maxvalAsNum
-    char maxval[10] = {'\0'};
-    int maxvalAsNum = -1;
-    i = 0;
-    fread(junk, 1, 1, filePointer);
-    while(junk[0] != '\n') {
-        maxval[i] = junk[0];
-        i++;
-        fread(junk, 1, 1, filePointer);
-    }
-    maxvalAsNum = atoi(maxval);
-
-    // read image data
-    if (tempImageType[1] == '5') {  // image is b&w
-        img->bwData = (unsigned char **) malloc(heightAsNum * sizeof(unsigned char *));
-        for (int i = 0; i < heightAsNum; i++) {
-            img->bwData[i] = (unsigned char *) malloc(widthAsNum * sizeof(unsigned char));
+#define BATCH_ARGC 2  // program and manifest
+
+// strip the --options out of argv, leaving the positional arguments
+void parseOptions(int *argc, char **argv, options *opts) {
+    opts->blockDepth = 1;
+    opts->layout = INTERLEAVED;
+    opts->isa = ISA_AUTO;
+    opts->threads = 1;
+    opts->pin = 1;
+    opts->io = IO_POSIX;
+    opts->splitSize = DEFAULT_SPLIT_SIZE;
+    opts->stripeRows = NO_STREAM;
+    opts->tiles = 0;
+    opts->stealRows = NO_STEAL;
+    opts->shared = 0;
+    opts->pipelineGroups = NO_PIPELINE;
+    opts->overlap = 0;
+    opts->convolution = CONV_AUTO;
+    opts->socketPath = NULL;
+    opts->tuneFile = NULL;
+    opts->tuningFile = DEFAULT_TUNING_FILE;
+    opts->tuned = NULL;
+    opts->fixed = 0;
+    opts->cacheDir = NULL;
+    opts->cacheSize = DEFAULT_CACHE_SIZE;
+    opts->prefixes = NULL;
+    opts->compression = DEFAULT_COMPRESSION;
+    opts->report = NULL;
+    opts->trace = NULL;
+
+    int kept = 1;
+    for (int i = 1; i < *argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            argv[kept++] = argv[i];
+            continue;
         }
-
-        unsigned char *buffer = (unsigned char *)malloc(widthAsNum * heightAsNum);
-    	fread(buffer, sizeof(unsigned char), widthAsNum * heightAsNum, filePointer);
-
-    	int k = 0;
-    	for (int i = 0; i < heightAsNum; i++) {
-    		for (int j = 0; j < widthAsNum; j++) {
-    			img->bwData[i][j] = buffer[k++];
-    		}
-    	}
-    	free(buffer);
-        img->redData = NULL;
-        img->greenData = NULL;
-        img->blueData = NULL;
-    } else {  // image is in color
-        img->redData = (unsigned char **) malloc(heightAsNum * sizeof(unsigned char *));
-        img->greenData = (unsigned char **) malloc(heightAsNum * sizeof(unsigned char *));
-        img->blueData = (unsigned char **) malloc(heightAsNum * sizeof(unsigned char *));
-
-        for (int i = 0; i < heightAsNum; i++) {
-            img->redData[i] = (unsigned char *)malloc(widthAsNum * sizeof(unsigned char));
-            img->greenData[i] = (unsigned char *)malloc(widthAsNum * sizeof(unsigned char));
-            img->blueData[i] = (unsigned char *)malloc(widthAsNum * sizeof(unsigned char));
-        }
-
-        unsigned char *buffer = (unsigned char *)malloc(heightAsNum * widthAsNum * 3);
-        fread(buffer, 1, heightAsNum * widthAsNum * 3, filePointer);
-
-        int k = 0;
-        for (int i = 0; i < heightAsNum; i++) {
-            for (int j = 0; j < widthAsNum; j++) {
-                img->redData[i][j] = buffer[k++];
-                img->greenData[i][j] = buffer[k++];
-                img->blueData[i][j] = buffer[k++];
-            }
-        }
-        free(buffer);
-        img->bwData = NULL;
-    }
-    // close input file
-    fclose(filePointer);
-
-    // put read image metadata inside the actual data structure
-    if (tempImageType[1] == '5') {
-        img->type = BW;
-    } else {
-        img->type = COLOR;
-    }
-    img->width = widthAsNum;
-    img->height = heightAsNum;
-    img->maxval = maxvalAsNum;
-}
-
-void writeData(const char * fileName, image *img) {
-    // open output file for writing
-    FILE *filePointer;
-    filePointer = fopen(fileName, "wb");
-    if (filePointer == NULL) {
-        perror("error opening input file");
-        exit(1);
-    }
-
-    if (img->type == BW)
-    {
-        char imgTypeLine[] = "P5\n";
-        fwrite(&imgTypeLine, sizeof(char), 3 * sizeof(char), filePointer);
-    } else {
-        char imgTypeLine[] = "P6\n";
-        fwrite(&imgTypeLine, sizeof(char), 3 * sizeof(char), filePointer);
-    }
-
-    //write image width and height line
-    char widthArray[100];
-    char heightArray[100];
-    sprintf(widthArray, "%d", img->width);
-    sprintf(heightArray, "%d", img->height);
-    char whiteSpace[] = " ";
-    char newLine[] = "\n";
-    fwrite(&widthArray, sizeof(char), strlen(widthArray), filePointer);
-    fwrite(&whiteSpace, sizeof(char), 1 * sizeof(char), filePointer);
-    fwrite(&heightArray, sizeof(char), strlen(heightArray), filePointer);
-    fwrite(&newLine, sizeof(char), 1 * sizeof(char), filePointer);
-    // write maxval line
-    char maxvalArray[100];
-    sprintf(maxvalArray, "%d", img->maxval);
-    fwrite(&maxvalArray, sizeof(char), strlen(maxvalArray), filePointer);
-    fwrite(&newLine, sizeof(char), 1 * sizeof(char), filePointer);
-
-    // write image data
-    if (img->type == BW || img->type == COLOR) {
-        if (img->type == BW) {
-            for (int i = 0; i < img->height; i++) {
-                fwrite(img->bwData[i], sizeof(unsigned char), img->width, filePointer);
-            }
-        } else {
-            for (int i = 0; i < img->height; i++) {
-                int k = 0;
-                for (int j = 0; j < img->width * 3; j++) {
-                    if (j % 3 == 0) {
-                        fwrite(&img->redData[i][k], 1, sizeof(unsigned char), filePointer);
-                    }
-                    if (j % 3 == 1) {
-                        fwrite(&img->greenData[i][k], 1, sizeof(unsigned char), filePointer);
-                    }
-                    if (j % 3 == 2) {
-                        fwrite(&img->blueData[i][k], 1, sizeof(unsigned char), filePointer);
-                        k++;
-                    }
+        if (strcmp(argv[i], "--block") == 0 && i + 1 < *argc) {
+            i++;
+            opts->fixed |= FIXED_BLOCK;
+            if (strcmp(argv[i], "auto") == 0) {
+                opts->blockDepth = AUTO_BLOCK;
+            } else {
+                opts->blockDepth = atoi(argv[i]);
+                if (opts->blockDepth < 1) {
+                    fprintf(stderr, "invalid block depth: %s\n", argv[i]);
+                    exit(1);
                 }
             }
-        }
-    }
-
-    // free allocated memory
-    if (img->type == BW) {
-        for (int i = 0; i < img->height; i++) {
-            free(img->bwData[i]);
-        }
-        free(img->bwData);
-    } else {
-        for (int i = 0; i < img->height; i++) {
-            free(img->redData[i]);
-            free(img->greenData[i]);
-            free(img->blueData[i]);
-
-        }
-        free(img->redData);
-        free(img->greenData);
-        free(img->blueData);
-    }
-    fclose(filePointer);
-}
-
-int main(int argc, char * argv[]) {
-    // read input data in image file
-    image givenImage;
-    readInput(argv[1], &givenImage);
-
-    // init a temp image & filter to work with
-    image temp;
-    image recvImage;
-    float filter[9];
-
-    if (givenImage.type == BW) {  // image is bw
-        temp.bwData = (unsigned char **)malloc(givenImage.height * sizeof(unsigned char *));
-        recvImage.bwData = (unsigned char **)malloc(givenImage.height * sizeof(unsigned char *));
-        for (int i = 0; i < givenImage.height; i++) {
-            temp.bwData[i] = (unsigned char *)malloc(givenImage.width * sizeof(unsigned char));
-            recvImage.bwData[i] = (unsigned char *)malloc(givenImage.width * sizeof(unsigned char));
-        }
-    } else {  // image is in color
-        temp.redData = (unsigned char **)malloc(givenImage.height * sizeof(unsigned char *));
-        temp.greenData = (unsigned char **)malloc(givenImage.height * sizeof(unsigned char *));
-        temp.blueData = (unsigned char **)malloc(givenImage.height * sizeof(unsigned char *));
-
-        recvImage.redData = (unsigned char **)malloc(givenImage.height * sizeof(unsigned char *));
-        recvImage.greenData = (unsigned char **)malloc(givenImage.height * sizeof(unsigned char *));
-        recvImage.blueData = (unsigned char **)malloc(givenImage.height * sizeof(unsigned char *));
-
-        for (int i = 0; i < givenImage.height; i++) {
-            temp.redData[i] = (unsigned char *)malloc(givenImage.width * sizeof(unsigned char));
-            temp.greenData[i] = (unsigned char *)malloc(givenImage.width * sizeof(unsigned char));
-            temp.blueData[i] = (unsigned char *)malloc(givenImage.width * sizeof(unsigned char));
-
-            recvImage.redData[i] = (unsigned char *)malloc(givenImage.width * sizeof(unsigned char));
-            recvImage.greenData[i] = (unsigned char *)malloc(givenImage.width * sizeof(unsigned char));
-            recvImage.blueData[i] = (unsigned char *)malloc(givenImage.width * sizeof(unsigned char));
-        }
-    }
-
-    // start the threads
-    int rank, size;
-    MPI_Init(&argc, &argv);
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &size);
-
-    // set the responsability of a thread
-    int mulFactor = (int)ceil((1.0 * givenImage.width * givenImage.height) / size);
-    int lowBound = mulFactor * rank;
-    int highBound = (int)fmin(mulFactor * (rank + 1), givenImage.width * givenImage.height);
-
-    if (givenImage.type == BW) {  // image is bw
-        // for each filter
-        for (int filterIndex = FILTER_START; filterIndex < FILTER_END; filterIndex++) {
-            // set the temp image
-            for (int i = 0; i < givenImage.height; i++) {
-                memcpy(temp.bwData[i], givenImage.bwData[i],
-                givenImage.width * sizeof(unsigned char));
-            }
-
-            // set the filter;
-            if (strcmp(argv[filterIndex], "smooth") == 0)
-            {
-                memcpy(filter, smoothingFilter, 9 * sizeof(float));
-            }
-            else if (strcmp(argv[filterIndex], "blur") == 0)
-            {
-                memcpy(filter, gaussBlurFilter, 9 * sizeof(float));
-            }
-            else if (strcmp(argv[filterIndex], "sharpen") == 0)
-            {
-                memcpy(filter, sharpenFilter, 9 * sizeof(float));
-            }
-            else if (strcmp(argv[filterIndex], "mean") == 0)
-            {
-                memcpy(filter, meanRemovalFilter, 9 * sizeof(float));
-            }
-            else if (strcmp(argv[filterIndex], "emboss") == 0)
-            {
-                memcpy(filter, embossFilter, 9 * sizeof(float));
-            }
-            MPI_Barrier(MPI_COMM_WORLD);
-            // apply the filter
-            for (int i = lowBound; i < highBound; i++) {
-                int line = i / givenImage.width;
-                int column = i % givenImage.width;
-
-                // do not touch border pixels
-                if (line > 0 && column > 0 && line < givenImage.height - 1
-                && column < givenImage.width - 1) {
-                    givenImage.bwData[line][column] =
-                       filter[0] * temp.bwData[line - 1][column - 1] +
-                       filter[1] * temp.bwData[line - 1][column] +
-                       filter[2] * temp.bwData[line - 1][column + 1] +
-                       filter[3] * temp.bwData[line][column - 1] +
-                       filter[4] * temp.bwData[line][column] +
-                       filter[5] * temp.bwData[line][column + 1] +
-                       filter[6] * temp.bwData[line + 1][column - 1] +
-                       filter[7] * temp.bwData[line + 1][column] +
-                       filter[8] * temp.bwData[line + 1][column + 1];
-                }
+        } else if (strcmp(argv[i], "--layout") == 0 && i + 1 < *argc) {
+            i++;
+            if (strcmp(argv[i], "planar") == 0) {
+                opts->layout = PLANAR;
+            } else if (strcmp(argv[i], "interleaved") == 0) {
+                opts->layout = INTERLEAVED;
+            } else {
+                fprintf(stderr, "invalid layout: %s\n", argv[i]);
+                exit(1);
             }
-            MPI_Barrier(MPI_COMM_WORLD);
-            // make givenImage with applied filter from all threads
-            if (rank != LEADER_RANK) {
-                for (int i = 0; i < givenImage.height; i++) {
-                    MPI_Send(givenImage.bwData[i], givenImage.width,
-                    MPI_UNSIGNED_CHAR, LEADER_RANK, 0, MPI_COMM_WORLD);
-                }
+        } else if (strcmp(argv[i], "--isa") == 0 && i + 1 < *argc) {
+            opts->isa = parseIsa(argv[++i]);
+            opts->fixed |= FIXED_ISA;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < *argc) {
+            i++;
+            opts->fixed |= FIXED_THREADS;
+            if (strcmp(argv[i], "auto") == 0) {
+                opts->threads = AUTO_THREADS;
             } else {
-                for (int i = 0; i < size; i++) {
-                    if (i != LEADER_RANK) {
-                        for (int j = 0; j < givenImage.height; j++) {
-                            MPI_Recv(recvImage.bwData[j],
-                                givenImage.width,
-                                MPI_UNSIGNED_CHAR, i, 0, MPI_COMM_WORLD,
-                                MPI_STATUS_IGNORE);
-                        }
-                        int ilowBound = mulFactor * i;
-                        int ihighBound = (int)fmin(mulFactor * (i + 1), givenImage.width * givenImage.height);
-
-                        for (int j = ilowBound; j < ihighBound; j++) {
-
-                            int lineI = j / givenImage.width;
-                            int columnI = j % givenImage.width;
-                            if (lineI > 0 && columnI > 0 && lineI < givenImage.height - 1
-                                && columnI < givenImage.width - 1) {
-                                givenImage.bwData[lineI][columnI] = recvImage.bwData[lineI][columnI];
-                            }
-                        }
-                    }
+                opts->threads = atoi(argv[i]);
+                if (opts->threads < 1) {
+                    fprintf(stderr, "invalid thread count: %s\n", argv[i]);
+                    exit(1);
                 }
             }
-
-            MPI_Barrier(MPI_COMM_WORLD);
-
-            // send updated givenImage to all processes
-            for (int i = 0; i < givenImage.height; i++) {
-                MPI_Bcast(givenImage.bwData[i], givenImage.width,
-                MPI_UNSIGNED_CHAR, LEADER_RANK, MPI_COMM_WORLD);
-            }
-            MPI_Barrier(MPI_COMM_WORLD);
-        }
-    } else {  // image is in color
-        // for each filter
-        for (int filterIndex = FILTER_START; filterIndex < FILTER_END; filterIndex++) {
-            // set the temp image
-            for (int i = 0; i < givenImage.height; i++) {
-                memcpy(temp.redData[i], givenImage.redData[i],
-                givenImage.width * sizeof(unsigned char));
-
-                memcpy(temp.greenData[i], givenImage.greenData[i],
-                givenImage.width * sizeof(unsigned char));
-
-                memcpy(temp.blueData[i], givenImage.blueData[i],
-                givenImage.width * sizeof(unsigned char));
-            }
-
-            // set the filter;
-            if (strcmp(argv[filterIndex], "smooth") == 0)
-            {
-                memcpy(filter, smoothingFilter, 9 * sizeof(float));
-            }
-            else if (strcmp(argv[filterIndex], "blur") == 0)
-            {
-                memcpy(filter, gaussBlurFilter, 9 * sizeof(float));
-            }
-            else if (strcmp(argv[filterIndex], "sharpen") == 0)
-            {
-                memcpy(filter, sharpenFilter, 9 * sizeof(float));
-            }
-            else if (strcmp(argv[filterIndex], "mean") == 0)
-            {
-                memcpy(filter, meanRemovalFilter, 9 * sizeof(float));
-            }
-            else if (strcmp(argv[filterIndex], "emboss") == 0)
-            {
-                memcpy(filter, embossFilter, 9 * sizeof(float));
-            }
-            MPI_Barrier(MPI_COMM_WORLD);
-            // apply the filter
-            for (int i = lowBound; i < highBound; i++) {
-                int line = i / givenImage.width;
-                int column = i % givenImage.width;
-
-                // do not touch border pixels
-                if (line > 0 && column > 0 && line < givenImage.height - 1
-                && column < givenImage.width - 1) {
-                    givenImage.redData[line][column] =
-                      filter[0] * temp.redData[line - 1][column - 1] +
-                      filter[1] * temp.redData[line - 1][column] +
-                      filter[2] * temp.redData[line - 1][column + 1] +
-                      filter[3] * temp.redData[line][column - 1] +
-                      filter[4] * temp.redData[line][column] +
-                      filter[5] * temp.redData[line][column + 1] +
-                      filter[6] * temp.redData[line + 1][column - 1] +
-                      filter[7] * temp.redData[line + 1][column] +
-                      filter[8] * temp.redData[line + 1][column + 1];
-
-                    givenImage.greenData[line][column] =
-                      filter[0] * temp.greenData[line - 1][column - 1] +
-                      filter[1] * temp.greenData[line - 1][column] +
-                      filter[2] * temp.greenData[line - 1][column + 1] +
-                      filter[3] * temp.greenData[line][column - 1] +
-                      filter[4] * temp.greenData[line][column] +
-                      filter[5] * temp.greenData[line][column + 1] +
-                      filter[6] * temp.greenData[line + 1][column - 1] +
-                      filter[7] * temp.greenData[line + 1][column] +
-                      filter[8] * temp.greenData[line + 1][column + 1];
-
-                    givenImage.blueData[line][column] =
-                     filter[0] * temp.blueData[line - 1][column - 1] +
-                     filter[1] * temp.blueData[line - 1][column] +
-                     filter[2] * temp.blueData[line - 1][column + 1] +
-                     filter[3] * temp.blueData[line][column - 1] +
-                     filter[4] * temp.blueData[line][column] +
-                     filter[5] * temp.blueData[line][column + 1] +
-                     filter[6] * temp.blueData[line + 1][column - 1] +
-                     filter[7] * temp.blueData[line + 1][column] +
-                     filter[8] * temp.blueData[line + 1][column + 1];
+        } else if (strcmp(argv[i], "--overlap") == 0) {
+            opts->overlap = 1;
+        } else if (strcmp(argv[i], "--tiles") == 0) {
+            opts->tiles = 1;
+            opts->fixed |= FIXED_LAYOUT;
+        } else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < *argc) {
+            opts->pipelineGroups = parsePipeline(argv[++i], opts->groupRanks);
+        } else if (strcmp(argv[i], "--shared") == 0) {
+            opts->shared = 1;
+        } else if (strcmp(argv[i], "--no-pin") == 0) {
+            opts->pin = 0;
+        } else if (strcmp(argv[i], "--io") == 0 && i + 1 < *argc) {
+            opts->io = parseIo(argv[++i]);
+        } else if (strcmp(argv[i], "--stream") == 0 && i + 1 < *argc) {
+            i++;
+            if (strcmp(argv[i], "auto") == 0) {
+                opts->stripeRows = AUTO_STRIPE;
+            } else {
+                opts->stripeRows = atoi(argv[i]);
+                if (opts->stripeRows < 1) {
+                    fprintf(stderr, "invalid stripe rows: %s\n", argv[i]);
+                    exit(1);
                 }
             }
-            MPI_Barrier(MPI_COMM_WORLD);
-            // make givenImage with applied filter from all threads
-            if (rank != LEADER_RANK) {
-                for (int i = 0; i < givenImage.height; i++) {
-                    MPI_Send(givenImage.redData[i], givenImage.width,
-                    MPI_UNSIGNED_CHAR, LEADER_RANK, 0, MPI_COMM_WORLD);
-                }
+        } else if (strcmp(argv[i], "--steal") == 0 && i + 1 < *argc) {
+            i++;
+            if (strcmp(argv[i], "auto") == 0) {
+                opts->stealRows = AUTO_CHUNK;
             } else {
-                for (int i = 0; i < size; i++) {
-                    if (i != LEADER_RANK) {
-                        for (int j = 0; j < givenImage.height; j++) {
-                            MPI_Recv(recvImage.redData[j],
-                                givenImage.width,
-                                MPI_UNSIGNED_CHAR, i, 0, MPI_COMM_WORLD,
-                                MPI_STATUS_IGNORE);
-                        }
-                        int ilowBound = mulFactor * i;
-                        int ihighBound = (int)fmin(mulFactor * (i + 1), givenImage.width * givenImage.height);
-
-                        for (int j = ilowBound; j < ihighBound; j++) {
-
-                            int lineI = j / givenImage.width;
-                            int columnI = j % givenImage.width;
-                            if (lineI > 0 && columnI > 0 && lineI < givenImage.height - 1
-                                && columnI < givenImage.width - 1) {
-                                givenImage.redData[lineI][columnI] = recvImage.redData[lineI][columnI];
-                            }
-                        }
-                    }
+                opts->stealRows = atoi(argv[i]);
+                if (opts->stealRows < 1) {
+                    fprintf(stderr, "invalid chunk rows: %s\n", argv[i]);
+                    exit(1);
                 }
             }
-            MPI_Barrier(MPI_COMM_WORLD);
-            if (rank != LEADER_RANK) {
-                for (int i = 0; i < givenImage.height; i++) {
-                    MPI_Send(givenImage.greenData[i], givenImage.width,
-                    MPI_UNSIGNED_CHAR, LEADER_RANK, 0, MPI_COMM_WORLD);
-                }
-            } else {
-                for (int i = 0; i < size; i++) {
-                    if (i != LEADER_RANK) {
-                        for (int j = 0; j < givenImage.height; j++) {
-                            MPI_Recv(recvImage.greenData[j],
-                                givenImage.width,
-                                MPI_UNSIGNED_CHAR, i, 0, MPI_COMM_WORLD,
-                                MPI_STATUS_IGNORE);
-                        }
-                        int ilowBound = mulFactor * i;
-                        int ihighBound = (int)fmin(mulFactor * (i + 1), givenImage.width * givenImage.height);
+        } else if (strcmp(argv[i], "--convolution") == 0 && i + 1 < *argc) {
+            opts->convolution = parseConvolution(argv[++i]);
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < *argc) {
+            opts->socketPath = argv[++i];
+        } else if (strcmp(argv[i], "--autotune") == 0 && i + 1 < *argc) {
+            opts->tuneFile = argv[++i];
+        } else if (strcmp(argv[i], "--tuning") == 0 && i + 1 < *argc) {
+            i++;
+            opts->tuningFile = strcmp(argv[i], "none") == 0 ? NULL : argv[i];
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < *argc) {
+            opts->cacheDir = argv[++i];
+        } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < *argc) {
+            i++;
+            opts->cacheSize = atol(argv[i]);
+            if (opts->cacheSize < 1) {
+                fprintf(stderr, "invalid cache size: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--compression") == 0 && i + 1 < *argc) {
+            opts->compression = parseCompression(argv[++i]);
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < *argc) {
+            opts->report = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < *argc) {
+            opts->trace = argv[++i];
+        } else if (strcmp(argv[i], "--split-size") == 0 && i + 1 < *argc) {
+            i++;
+            opts->splitSize = atol(argv[i]);
+            if (opts->splitSize < 1) {
+                fprintf(stderr, "invalid split size: %s\n", argv[i]);
+                exit(1);
+            }
+        } else {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+    *argc = kept;
 
-                        for (int j = ilowBound; j < ihighBound; j++) {
+    if (opts->tuneFile != NULL && (opts->pipelineGroups != NO_PIPELINE ||
+        opts->socketPath != NULL)) {
+        fprintf(stderr, "--autotune times single jobs and manifests only\n");
+        exit(1);
+    }
 
-                            int lineI = j / givenImage.width;
-                            int columnI = j % givenImage.width;
-                            if (lineI > 0 && columnI > 0 && lineI < givenImage.height - 1
-                                && columnI < givenImage.width - 1) {
-                                givenImage.greenData[lineI][columnI] = recvImage.greenData[lineI][columnI];
-                            }
-                        }
-                    }
-                }
-            }
-            MPI_Barrier(MPI_COMM_WORLD);
-            if (rank != LEADER_RANK) {
-                for (int i = 0; i < givenImage.height; i++) {
-                    MPI_Send(givenImage.blueData[i], givenImage.width,
-                    MPI_UNSIGNED_CHAR, LEADER_RANK, 0, MPI_COMM_WORLD);
-                }
-            } else {
-                for (int i = 0; i < size; i++) {
-                    if (i != LEADER_RANK) {
-                        for (int j = 0; j < givenImage.height; j++) {
-                            MPI_Recv(recvImage.blueData[j],
-                                givenImage.width,
-                                MPI_UNSIGNED_CHAR, i, 0, MPI_COMM_WORLD,
-                                MPI_STATUS_IGNORE);
-                        }
-                        int ilowBound = mulFactor * i;
-                        int ihighBound = (int)fmin(mulFactor * (i + 1), givenImage.width * givenImage.height);
+    if (*argc < BATCH_ARGC && opts->socketPath == NULL) {
+        fprintf(stderr, "usage: %s [--block k|auto] "
+            "[--layout planar|interleaved] [--isa name] "
+            "[--threads n|auto] [--no-pin] [--io posix|mpi|mmap|funnel] "
+            "[--stream rows|auto] [--tiles] [--steal rows|auto] [--shared] "
+            "[--pipeline n,n...|auto] [--overlap] [--split-size bytes] "
+            "[--convolution auto|direct|separable|fft] [--cache dir] "
+            "[--cache-size bytes] [--autotune file] [--tuning file|none] "
+            "[--compression level] [--profile report.json] "
+            "[--trace trace.json] input output [filters...] | manifest | "
+            "--serve socket\n",
+            argv[0]);
+        exit(1);
+    }
+}
 
-                        for (int j = ilowBound; j < ihighBound; j++) {
+int main(int argc, char * argv[]) {
+    options opts;
+    parseOptions(&argc, argv, &opts);
 
-                            int lineI = j / givenImage.width;
-                            int columnI = j % givenImage.width;
-                            if (lineI > 0 && columnI > 0 && lineI < givenImage.height - 1
-                                && columnI < givenImage.width - 1) {
-                                givenImage.blueData[lineI][columnI] = recvImage.blueData[lineI][columnI];
-                            }
-                        }
-                    }
-                }
-            }
-            MPI_Barrier(MPI_COMM_WORLD);
-            // send updated givenImage to all processes
-            for (int i = 0; i < givenImage.height; i++) {
-                MPI_Bcast(givenImage.redData[i], givenImage.width,
-                MPI_UNSIGNED_CHAR, LEADER_RANK, MPI_COMM_WORLD);
+    // start the threads
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+
+    // the settings an earlier autotune found fastest on this machine
+    tuning *tuned = NULL;
+    if (opts.tuneFile == NULL && opts.tuningFile != NULL) {
+        tuned = loadTuning(opts.tuningFile,
+            strcmp(opts.tuningFile, DEFAULT_TUNING_FILE) != 0);
+        opts.tuned = tuned;
+    }
 
-                MPI_Bcast(givenImage.greenData[i], givenImage.width,
-                MPI_UNSIGNED_CHAR, LEADER_RANK, MPI_COMM_WORLD);
+    // vector kernels picked once, from what the cpu supports
+    selectKernels(opts.isa);
+    selectConvolution(opts.convolution);
 
-                MPI_Bcast(givenImage.blueData[i], givenImage.width,
-                MPI_UNSIGNED_CHAR, LEADER_RANK, MPI_COMM_WORLD);
-            }
-            MPI_Barrier(MPI_COMM_WORLD);
-        }
+    // the workers only filter, MPI stays on the main thread
+    int threads = opts.threads == AUTO_THREADS ? availableCpus() : opts.threads;
+    if (!(opts.fixed & FIXED_THREADS) && opts.tuneFile != NULL) {
+        threads = tuneThreads(MPI_COMM_WORLD);
+    } else if (!(opts.fixed & FIXED_THREADS) && tuned != NULL) {
+        threads = tunedThreads(tuned);
     }
+    if (provided < MPI_THREAD_FUNNELED && threads > 1) {
+        fprintf(stderr, "MPI library is not thread safe, using one thread\n");
+        threads = 1;
+    }
+    threadPool pool;
+    startPool(&pool, threads, opts.pin);
 
-    // join the threads
-    MPI_Finalize();
+    // timers cost a flag test each unless asked for
+    if (opts.report != NULL || opts.trace != NULL) {
+        startProfile(opts.trace != NULL, MPI_COMM_WORLD);
+    }
 
-    // clear up temp image data
-    if (givenImage.type == BW) {  // image is bw
-        for (int i = 0; i < givenImage.height; i++) {
-            free(temp.bwData[i]);
-            free(recvImage.bwData[i]);
-        }
-        free(temp.bwData);
-        free(recvImage.bwData);
+    if (opts.socketPath != NULL) {  // jobs from clients until told to stop
+        runServer(opts.socketPath, &opts, &pool, MPI_COMM_WORLD);
+    } else if (argc == BATCH_ARGC && opts.tuneFile != NULL) {
+        tuneBatch(argv[1], &opts, &pool, MPI_COMM_WORLD);
+    } else if (argc == BATCH_ARGC) {  // a manifest of images
+        runBatch(argv[1], &opts, &pool, MPI_COMM_WORLD);
     } else {
-        for (int i = 0; i < givenImage.height; i++) {
-            free(temp.redData[i]);
-            free(temp.greenData[i]);
-            free(temp.blueData[i]);
+        // look the filters up once, not on every pass
+        imageJob job = {argv[1], argv[2], NULL, FILTER_END - FILTER_START};
+        job.chain = (const filterDef **)malloc(
+            (job.filterCount > 0 ? job.filterCount : 1) * sizeof(filterDef *));
+        for (int i = 0; i < job.filterCount; i++) {
+            job.chain[i] = findFilter(argv[FILTER_START + i]);
+        }
 
-            free(recvImage.redData[i]);
-            free(recvImage.greenData[i]);
-            free(recvImage.blueData[i]);
+        if (opts.tuneFile != NULL) {
+            autotune(&job, 1, &opts, &pool, MPI_COMM_WORLD);
+        } else {
+            processImage(&job, &opts, &pool, MPI_COMM_WORLD);
         }
-        free(temp.redData);
-        free(temp.greenData);
-        free(temp.blueData);
+        free(job.chain);
+    }
 
-        free(recvImage.redData);
-        free(recvImage.greenData);
-        free(recvImage.blueData);
+    if (opts.cacheDir != NULL) {
+        reportCache(MPI_COMM_WORLD);
     }
+    writeProfile(opts.report, opts.trace, MPI_COMM_WORLD);
+    free(tuned);
 
-    // write the output data (and free image allocated space)
-    writeData(argv[2], &givenImage);
+    // join the threads
+    stopPool(&pool);
+    MPI_Finalize();
 
     return 0;
 }
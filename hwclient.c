@@ -0,0 +1,167 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// send jobs to a homework --serve socket: one job, the same job many times
+// with the latency of every round trip, or the stats and stop requests
+#define CONNECT_TRIES 100  // the server may still be starting
+#define CONNECT_WAIT_US 100000
+#define LINE_MAX_BYTES 65536
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [--repeat n] socket input output "
+        "[filters...] | socket stats | socket stop\n", program);
+    exit(1);
+}
+
+static int connectServer(const char *socketPath) {
+    struct sockaddr_un address;
+
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", socketPath);
+        exit(1);
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+
+    for (int i = 0; i < CONNECT_TRIES; i++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("error opening socket");
+            exit(1);
+        }
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+            return fd;
+        }
+        int failure = errno;
+        close(fd);
+        if (failure != ENOENT && failure != ECONNREFUSED) {
+            errno = failure;
+            break;
+        }
+        usleep(CONNECT_WAIT_US);
+    }
+    perror("error connecting to server");
+    exit(1);
+}
+
+// the server runs elsewhere, so paths go absolute; a filter with a '/' or
+// a '.' names a kernel file
+static void appendPath(char *line, const char *path, int isPath) {
+    char cwd[PATH_MAX];
+
+    if (line[0] != '\0') {
+        strcat(line, " ");
+    }
+    if (isPath && path[0] != '/' && getcwd(cwd, sizeof(cwd)) != NULL) {
+        strcat(line, cwd);
+        strcat(line, "/");
+    }
+    if (strlen(line) + strlen(path) >= LINE_MAX_BYTES - 1) {
+        fprintf(stderr, "job too long\n");
+        exit(1);
+    }
+    strcat(line, path);
+}
+
+static int compareSeconds(const void *a, const void *b) {
+    double first = *(const double *)a;
+    double second = *(const double *)b;
+
+    return (first > second) - (first < second);
+}
+
+static double percentile(const double *sorted, int count, int percent) {
+    int index = (count * percent + 99) / 100 - 1;
+
+    return count > 0 ? sorted[index > 0 ? index : 0] : 0;
+}
+
+static double now(void) {
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+    int repeat = 1;
+    int first = 1;
+
+    if (argc > 2 && strcmp(argv[1], "--repeat") == 0) {
+        repeat = atoi(argv[2]);
+        first = 3;
+        if (repeat < 1) {
+            usage(argv[0]);
+        }
+    }
+    if (argc - first < 2) {
+        usage(argv[0]);
+    }
+
+    // a single word is a request, anything longer a job
+    static char line[LINE_MAX_BYTES];
+    int isJob = argc - first > 2;
+    if (isJob) {
+        for (int i = first + 1; i < argc; i++) {
+            int isPath = i < first + 3 || strchr(argv[i], '/') != NULL ||
+                strchr(argv[i], '.') != NULL;
+            appendPath(line, argv[i], isPath);
+        }
+    } else {
+        appendPath(line, argv[first + 1], 0);
+    }
+    strcat(line, "\n");
+
+    int fd = connectServer(argv[first]);
+    FILE *replies = fdopen(fd, "r");
+    double *seconds = (double *)malloc(repeat * sizeof(double));
+    char *reply = NULL;
+    size_t length = 0;
+    int failed = 0;
+    for (int i = 0; i < repeat; i++) {
+        double start = now();
+        size_t sent = 0;
+        size_t size = strlen(line);
+        while (sent < size) {
+            ssize_t count = write(fd, line + sent, size - sent);
+            if (count < 0) {
+                perror("error sending job");
+                exit(1);
+            }
+            sent += count;
+        }
+        if (getline(&reply, &length, replies) == -1) {
+            fprintf(stderr, "server closed the connection\n");
+            exit(1);
+        }
+        seconds[i] = now() - start;
+        failed |= strncmp(reply, "error", 5) == 0;
+        if (repeat == 1 || failed) {
+            fputs(reply, failed ? stderr : stdout);
+        }
+        if (failed) {
+            break;
+        }
+    }
+
+    // the round trips as the client saw them
+    if (repeat > 1 && !failed) {
+        qsort(seconds, repeat, sizeof(double), compareSeconds);
+        printf("%d requests, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", repeat,
+            1000 * percentile(seconds, repeat, 50),
+            1000 * percentile(seconds, repeat, 99),
+            1000 * percentile(seconds, repeat, 100));
+    }
+    free(reply);
+    free(seconds);
+    fclose(replies);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+
+void initImage(image *img, int type, int width, int height, int maxval,
+    int layout) {
+    img->type = type;
+    img->width = width;
+    img->height = height;
+    img->maxval = maxval;
+    img->channels = type == BW ? IMAGE_SIZE_BW : IMAGE_SIZE_COL;
+    img->layout = img->channels == IMAGE_SIZE_BW ? INTERLEAVED : layout;
+
+    if (img->layout == PLANAR) {
+        img->planes = img->channels;
+        img->step = 1;
+        img->rowSamples = width;
+    } else {
+        img->planes = 1;
+        img->step = img->channels;
+        img->rowSamples = width * img->channels;
+    }
+
+    // pad every row so each one starts on its own cache line
+    img->stride = ((size_t)img->rowSamples + IMAGE_ALIGNMENT - 1)
+        / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+    img->firstRow = 0;
+    img->rows = 0;
+    img->planeSize = 0;
+    img->data = NULL;
+}
+
+void allocRows(image *img, int firstRow, int rows) {
+    img->firstRow = firstRow;
+    img->rows = rows;
+    img->planeSize = img->stride * rows;
+
+    void *data = NULL;
+    size_t size = img->planeSize * img->planes;
+    if (posix_memalign(&data, IMAGE_ALIGNMENT, size > 0 ? size : IMAGE_ALIGNMENT) != 0) {
+        perror("error allocating image");
+        exit(1);
+    }
+    img->data = (unsigned char *)data;
+}
+
+void allocImage(image *img, int type, int width, int height, int maxval,
+    int layout) {
+    initImage(img, type, width, height, maxval, layout);
+    allocRows(img, 0, height);
+}
+
+void freeImage(image *img) {
+    free(img->data);
+    img->data = NULL;
+}
+
+void deinterleaveRow(image *img, int row, const unsigned char *pixels) {
+    unsigned char *red = imageRow(img, 0, row);
+    unsigned char *green = imageRow(img, 1, row);
+    unsigned char *blue = imageRow(img, 2, row);
+
+    for (int j = 0; j < img->width; j++) {
+        red[j] = pixels[3 * j];
+        green[j] = pixels[3 * j + 1];
+        blue[j] = pixels[3 * j + 2];
+    }
+}
+
+void interleaveRow(const image *img, int row, unsigned char *pixels) {
+    const unsigned char *red = imageRow(img, 0, row);
+    const unsigned char *green = imageRow(img, 1, row);
+    const unsigned char *blue = imageRow(img, 2, row);
+
+    for (int j = 0; j < img->width; j++) {
+        pixels[3 * j] = red[j];
+        pixels[3 * j + 1] = green[j];
+        pixels[3 * j + 2] = blue[j];
+    }
+}
+
+MPI_Datatype createRowsType(const image *img, int rows) {
+    MPI_Datatype rowType, rowsType;
+
+    // the same rows of every plane, one plane size apart; counted in rows,
+    // so bands past 2 GiB do not overflow the block length
+    MPI_Type_contiguous((int)img->stride, MPI_UNSIGNED_CHAR, &rowType);
+    MPI_Type_create_hvector(img->planes, rows, (MPI_Aint)img->planeSize,
+        rowType, &rowsType);
+    MPI_Type_commit(&rowsType);
+    MPI_Type_free(&rowType);
+    return rowsType;
+}
+
+int messageRows(const image *img) {
+    long rows = ROWS_MESSAGE_MAX / ((long)img->stride * img->planes);
+    return rows > 0 ? (int)rows : 1;
+}
@@ -0,0 +1,65 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <mpi.h>
+#include <stddef.h>
+
+#define IMAGE_SIZE_BW 1
+#define IMAGE_SIZE_COL 3
+#define BW 5
+#define COLOR 6
+#define UNDEFINED -1
+
+// sample layout of a color image
+#define INTERLEAVED 0  // rgbrgb..., same as the P6 payload
+#define PLANAR 1  // one plane per channel
+
+#define IMAGE_ALIGNMENT 64
+#define HEADER_MAX 64  // longest header formatHeader produces
+#define ROWS_MESSAGE_MAX (1L << 30)  // bytes of rows sent in one message
+
+typedef struct {
+    int type;  // store all data for any type of image
+    int width;
+    int height;
+    int maxval;
+    int layout;
+    int channels;  // IMAGE_SIZE_BW or IMAGE_SIZE_COL
+    int planes;  // planes stored, 1 unless the color image is planar
+    int step;  // distance in samples between two horizontal neighbours
+    int rowSamples;  // samples in a row of one plane
+    size_t stride;  // bytes between two rows, padded to IMAGE_ALIGNMENT
+    int firstRow;  // first image row stored, a band keeps only its rows
+    int rows;  // rows stored
+    size_t planeSize;  // bytes between two planes
+    unsigned char *data;  // one aligned allocation for all planes
+}image;
+
+// first sample of an image row in a plane, the row has to be stored
+static inline unsigned char *imageRow(const image *img, int plane, int row) {
+    return img->data + plane * img->planeSize
+        + (size_t)(row - img->firstRow) * img->stride;
+}
+
+// fill in the shape of an image, without storage
+void initImage(image *img, int type, int width, int height, int maxval,
+    int layout);
+// store the rows [firstRow, firstRow + rows) of an initialized image
+void allocRows(image *img, int firstRow, int rows);
+// initImage and allocRows for every row
+void allocImage(image *img, int type, int width, int height, int maxval,
+    int layout);
+void freeImage(image *img);
+
+// planar rows from and to the rgbrgb... order of the P6 payload
+void deinterleaveRow(image *img, int row, const unsigned char *pixels);
+void interleaveRow(const image *img, int row, unsigned char *pixels);
+
+// datatype covering rows consecutive rows of every plane, for a buffer
+// starting at imageRow(img, 0, firstRow); free it with MPI_Type_free
+MPI_Datatype createRowsType(const image *img, int rows);
+// rows of every plane that fit in ROWS_MESSAGE_MAX bytes, at least one;
+// whole bands go out in messages of that many rows
+int messageRows(const image *img);
+
+#endif
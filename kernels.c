@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+#define MAX_FIXED_SHIFT 8
+#define MAX_FIXED_SUM 32767  // largest 16-bit partial sum
+
+static rowKernel currentKernel = filterRowScalar;
+static int currentIsa = ISA_SCALAR;
+
+void prepareStencil(stencil *st, const float *weights) {
+    memcpy(st->weights, weights, sizeof(st->weights));
+    st->isFixed = 0;
+    st->shift = 0;
+    st->kernel = currentKernel;
+
+    // look for the smallest power of two turning every weight into an integer
+    for (int shift = 0; shift <= MAX_FIXED_SHIFT; shift++) {
+        float scale = (float)(1 << shift);
+        int sum = 0;
+        int exact = 1;
+
+        for (int i = 0; i < STENCIL_TAPS; i++) {
+            float tap = weights[i] * scale;
+            if (tap != truncf(tap) || fabsf(tap) > MAX_FIXED_SUM) {
+                exact = 0;
+                break;
+            }
+            st->taps[i] = (short)tap;
+            sum += abs(st->taps[i]);
+        }
+        if (exact) {
+            // every partial sum has to fit in 16 bits (and in a float mantissa)
+            if (sum * 255 <= MAX_FIXED_SUM) {
+                st->isFixed = 1;
+                st->shift = shift;
+            }
+            return;
+        }
+    }
+}
+
+void filterRowScalar(unsigned char *out, const unsigned char *above,
+    const unsigned char *row, const unsigned char *below, int begin, int end,
+    int step, const stencil *st) {
+    const float *filter = st->weights;
+
+    // through int, so values out of 0..255 wrap instead of being undefined
+    for (int x = begin; x < end; x++) {
+        out[x] = (int)(
+            filter[0] * above[x - step] +
+            filter[1] * above[x] +
+            filter[2] * above[x + step] +
+            filter[3] * row[x - step] +
+            filter[4] * row[x] +
+            filter[5] * row[x + step] +
+            filter[6] * below[x - step] +
+            filter[7] * below[x] +
+            filter[8] * below[x + step]);
+    }
+}
+
+#ifdef HAVE_X86
+// collect the non zero taps in the order the float sum adds them; adding a
+// zero product never changes the truncated result, so they can be skipped
+static int collectTaps(const unsigned char **sources, float *weights,
+    short *taps, const unsigned char *above, const unsigned char *row,
+    const unsigned char *below, int step, const stencil *st) {
+    const unsigned char *rows[3] = {above, row, below};
+    int count = 0;
+
+    for (int i = 0; i < STENCIL_TAPS; i++) {
+        if (st->weights[i] != 0) {
+            sources[count] = rows[i / 3] + (i % 3 - 1) * step;
+            weights[count] = st->weights[i];
+            taps[count] = st->taps[i];
+            count++;
+        }
+    }
+    return count;
+}
+
+__attribute__((target("sse4.1")))
+static void filterRowSse41(unsigned char *out, const unsigned char *above,
+    const unsigned char *row, const unsigned char *below, int begin, int end,
+    int step, const stencil *st) {
+    const unsigned char *sources[STENCIL_TAPS];
+    float weights[STENCIL_TAPS];
+    short taps[STENCIL_TAPS];
+    int count = collectTaps(sources, weights, taps, above, row, below, step, st);
+    int x = begin;
+
+    if (st->isFixed) {  // 8 samples in 16-bit lanes
+        __m128i bias = _mm_set1_epi16((1 << st->shift) - 1);
+        __m128i shift = _mm_cvtsi32_si128(st->shift);
+        __m128i mask = _mm_set1_epi16(0xff);
+
+        for (; x + 8 <= end; x += 8) {
+            __m128i acc = _mm_setzero_si128();
+            for (int k = 0; k < count; k++) {
+                __m128i v = _mm_cvtepu8_epi16(
+                    _mm_loadl_epi64((const __m128i *)(sources[k] + x)));
+                acc = _mm_add_epi16(acc, _mm_mullo_epi16(v, _mm_set1_epi16(taps[k])));
+            }
+            // divide rounding toward zero, like the float truncation
+            acc = _mm_add_epi16(acc, _mm_and_si128(_mm_srai_epi16(acc, 15), bias));
+            acc = _mm_and_si128(_mm_sra_epi16(acc, shift), mask);
+            _mm_storel_epi64((__m128i *)(out + x), _mm_packus_epi16(acc, acc));
+        }
+    } else {  // 8 samples in two float vectors
+        __m128i mask = _mm_set1_epi32(0xff);
+
+        for (; x + 8 <= end; x += 8) {
+            __m128 lo = _mm_setzero_ps();
+            __m128 hi = _mm_setzero_ps();
+            for (int k = 0; k < count; k++) {
+                __m128i bytes = _mm_loadl_epi64((const __m128i *)(sources[k] + x));
+                __m128 w = _mm_set1_ps(weights[k]);
+                lo = _mm_add_ps(lo, _mm_mul_ps(w,
+                    _mm_cvtepi32_ps(_mm_cvtepu8_epi32(bytes))));
+                hi = _mm_add_ps(hi, _mm_mul_ps(w,
+                    _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(bytes, 4)))));
+            }
+            // keep the low byte of the truncated value, as the scalar store does
+            __m128i ilo = _mm_and_si128(_mm_cvttps_epi32(lo), mask);
+            __m128i ihi = _mm_and_si128(_mm_cvttps_epi32(hi), mask);
+            __m128i words = _mm_packus_epi32(ilo, ihi);
+            _mm_storel_epi64((__m128i *)(out + x), _mm_packus_epi16(words, words));
+        }
+    }
+    filterRowScalar(out, above, row, below, x, end, step, st);
+}
+
+__attribute__((target("avx2")))
+static void filterRowAvx2(unsigned char *out, const unsigned char *above,
+    const unsigned char *row, const unsigned char *below, int begin, int end,
+    int step, const stencil *st) {
+    const unsigned char *sources[STENCIL_TAPS];
+    float weights[STENCIL_TAPS];
+    short taps[STENCIL_TAPS];
+    int count = collectTaps(sources, weights, taps, above, row, below, step, st);
+    int x = begin;
+
+    if (st->isFixed) {  // 16 samples in 16-bit lanes
+        __m256i bias = _mm256_set1_epi16((1 << st->shift) - 1);
+        __m128i shift = _mm_cvtsi32_si128(st->shift);
+        __m256i mask = _mm256_set1_epi16(0xff);
+
+        for (; x + 16 <= end; x += 16) {
+            __m256i acc = _mm256_setzero_si256();
+            for (int k = 0; k < count; k++) {
+                __m256i v = _mm256_cvtepu8_epi16(
+                    _mm_loadu_si128((const __m128i *)(sources[k] + x)));
+                acc = _mm256_add_epi16(acc,
+                    _mm256_mullo_epi16(v, _mm256_set1_epi16(taps[k])));
+            }
+            acc = _mm256_add_epi16(acc,
+                _mm256_and_si256(_mm256_srai_epi16(acc, 15), bias));
+            acc = _mm256_and_si256(_mm256_sra_epi16(acc, shift), mask);
+            _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(
+                _mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)));
+        }
+    } else {  // 16 samples in two float vectors
+        __m256i mask = _mm256_set1_epi32(0xff);
+
+        for (; x + 16 <= end; x += 16) {
+            __m256 lo = _mm256_setzero_ps();
+            __m256 hi = _mm256_setzero_ps();
+            for (int k = 0; k < count; k++) {
+                __m128i bytes = _mm_loadu_si128((const __m128i *)(sources[k] + x));
+                __m256 w = _mm256_set1_ps(weights[k]);
+                lo = _mm256_add_ps(lo, _mm256_mul_ps(w,
+                    _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes))));
+                hi = _mm256_add_ps(hi, _mm256_mul_ps(w,
+                    _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8)))));
+            }
+            __m256i ilo = _mm256_and_si256(_mm256_cvttps_epi32(lo), mask);
+            __m256i ihi = _mm256_and_si256(_mm256_cvttps_epi32(hi), mask);
+            // packus works per 128-bit lane, put the quarters back in order
+            __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(ilo, ihi), 0xd8);
+            _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(
+                _mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1)));
+        }
+    }
+    filterRowScalar(out, above, row, below, x, end, step, st);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void filterRowAvx512(unsigned char *out, const unsigned char *above,
+    const unsigned char *row, const unsigned char *below, int begin, int end,
+    int step, const stencil *st) {
+    const unsigned char *sources[STENCIL_TAPS];
+    float weights[STENCIL_TAPS];
+    short taps[STENCIL_TAPS];
+    int count = collectTaps(sources, weights, taps, above, row, below, step, st);
+    int x = begin;
+
+    if (st->isFixed) {  // 32 samples in 16-bit lanes
+        __m512i bias = _mm512_set1_epi16((1 << st->shift) - 1);
+        __m128i shift = _mm_cvtsi32_si128(st->shift);
+
+        for (; x + 32 <= end; x += 32) {
+            __m512i acc = _mm512_setzero_si512();
+            for (int k = 0; k < count; k++) {
+                __m512i v = _mm512_cvtepu8_epi16(
+                    _mm256_loadu_si256((const __m256i *)(sources[k] + x)));
+                acc = _mm512_add_epi16(acc,
+                    _mm512_mullo_epi16(v, _mm512_set1_epi16(taps[k])));
+            }
+            acc = _mm512_add_epi16(acc,
+                _mm512_and_si512(_mm512_srai_epi16(acc, 15), bias));
+            acc = _mm512_sra_epi16(acc, shift);
+            // the narrowing move keeps the low byte, no mask needed
+            _mm256_storeu_si256((__m256i *)(out + x), _mm512_cvtepi16_epi8(acc));
+        }
+    } else {  // 16 samples in one float vector
+        for (; x + 16 <= end; x += 16) {
+            __m512 acc = _mm512_setzero_ps();
+            for (int k = 0; k < count; k++) {
+                __m128i bytes = _mm_loadu_si128((const __m128i *)(sources[k] + x));
+                acc = _mm512_add_ps(acc, _mm512_mul_ps(_mm512_set1_ps(weights[k]),
+                    _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(bytes))));
+            }
+            _mm_storeu_si128((__m128i *)(out + x),
+                _mm512_cvtepi32_epi8(_mm512_cvttps_epi32(acc)));
+        }
+    }
+    filterRowScalar(out, above, row, below, x, end, step, st);
+}
+#endif
+
+
+int detectIsa(void) {
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return ISA_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return ISA_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return ISA_SSE41;
+    }
+#endif
+    return ISA_SCALAR;
+}
+
+int selectKernels(int isa) {
+    int supported = detectIsa();
+
+    if (isa == ISA_AUTO) {
+        isa = supported;
+    }
+    if (isa > supported) {
+        fprintf(stderr, "%s kernels are not supported by this cpu\n", isaName(isa));
+        exit(1);
+    }
+
+    currentIsa = isa;
+    switch (isa) {
+#ifdef HAVE_X86
+    case ISA_SSE41:
+        currentKernel = filterRowSse41;
+        break;
+    case ISA_AVX2:
+        currentKernel = filterRowAvx2;
+        break;
+    case ISA_AVX512:
+        currentKernel = filterRowAvx512;
+        break;
+#endif
+    default:
+        currentKernel = filterRowScalar;
+        break;
+    }
+    return isa;
+}
+
+int activeIsa(void) {
+    return currentIsa;
+}
+
+const char *isaName(int isa) {
+    switch (isa) {
+    case ISA_SSE41:
+        return "sse4.1";
+    case ISA_AVX2:
+        return "avx2";
+    case ISA_AVX512:
+        return "avx512";
+    case ISA_AUTO:
+        return "auto";
+    default:
+        return "scalar";
+    }
+}
+
+int parseIsa(const char *name) {
+    for (int isa = ISA_AUTO; isa <= ISA_AVX512; isa++) {
+        if (strcmp(name, isaName(isa)) == 0) {
+            return isa;
+        }
+    }
+    fprintf(stderr, "unknown instruction set: %s\n", name);
+    exit(1);
+}
+
+void filterRow(unsigned char *out, const unsigned char *above,
+    const unsigned char *row, const unsigned char *below, int begin, int end,
+    int step, const stencil *st) {
+    st->kernel(out, above, row, below, begin, end, step, st);
+}
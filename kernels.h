@@ -0,0 +1,53 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+// instruction sets a row kernel can be built for
+#define ISA_AUTO -1
+#define ISA_SCALAR 0
+#define ISA_SSE41 1
+#define ISA_AVX2 2
+#define ISA_AVX512 3
+#define ISA_COUNT 4
+
+#define STENCIL_TAPS 9
+
+// a 3x3 filter, prepared once per pass
+typedef struct stencil stencil;
+
+// filters the samples [begin, end) of a row, step samples between neighbours
+typedef void (*rowKernel)(unsigned char *out, const unsigned char *above,
+    const unsigned char *row, const unsigned char *below, int begin, int end,
+    int step, const stencil *st);
+
+struct stencil {
+    float weights[STENCIL_TAPS];
+    // the float result is exact when every weight is k / 2^shift with a
+    // small integer k, so the sum can run on 16-bit integers instead
+    int isFixed;
+    int shift;
+    short taps[STENCIL_TAPS];
+    rowKernel kernel;  // picked once per pass
+};
+
+// fill in a stencil for weights, run by the selected vector kernels
+void prepareStencil(stencil *st, const float *weights);
+
+// the reference float loop, every other kernel must match it bit for bit
+void filterRowScalar(unsigned char *out, const unsigned char *above,
+    const unsigned char *row, const unsigned char *below, int begin, int end,
+    int step, const stencil *st);
+
+// pick the row kernels for isa, ISA_AUTO for the best one the cpu runs;
+// returns the isa in use
+int selectKernels(int isa);
+int detectIsa(void);
+int activeIsa(void);
+const char *isaName(int isa);
+int parseIsa(const char *name);
+
+// run the kernel of a stencil on the samples [begin, end) of a row
+void filterRow(unsigned char *out, const unsigned char *above,
+    const unsigned char *row, const unsigned char *below, int begin, int end,
+    int step, const stencil *st);
+
+#endif
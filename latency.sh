@@ -0,0 +1,75 @@
+#!/bin/bash
+# Latency of the server mode: starts homework --serve, sends the same small
+# job REQUESTS times through hwclient and prints the p50 and p99 round trip,
+# next to a few one shot mpirun launches of the same job. The served output
+# is compared bit for bit with the one shot one; the script fails if any
+# pixel differs.
+#
+# Settings, from the environment:
+#   SIZE       side of the synthetic square image (512)
+#   TYPE       pgm for grey, pnm for color (pgm)
+#   CHAIN      filters of the job (blur sharpen)
+#   RANKS      server ranks (2)
+#   REQUESTS   jobs sent to the server (200)
+#   LAUNCHES   one shot runs to compare with (5)
+#   OPTIONS    extra homework options, e.g. "--threads 2"
+#   TUNING     tuning file of both sides; with none both run on RANKS ranks
+#              with the options given (none)
+#   MPIRUN     launcher (mpirun)
+#   LATENCY_DIR  where the image, outputs and socket go (latency_out)
+
+SIZE=${SIZE:-512}
+TYPE=${TYPE:-pgm}
+CHAIN=${CHAIN:-"blur sharpen"}
+RANKS=${RANKS:-2}
+REQUESTS=${REQUESTS:-200}
+LAUNCHES=${LAUNCHES:-5}
+OPTIONS=${OPTIONS:-}
+TUNING=${TUNING:-none}
+MPIRUN=${MPIRUN:-mpirun}
+LATENCY_DIR=${LATENCY_DIR:-latency_out}
+
+HOMEWORK=$(pwd)/homework
+HWCLIENT=$(pwd)/hwclient
+GENIMAGE=$(pwd)/genimage
+
+mkdir -p "$LATENCY_DIR"
+DIR=$(cd "$LATENCY_DIR" && pwd)
+SOCKET="$DIR/homework.sock"
+IMAGE="$DIR/synthetic_${SIZE}x$SIZE.$TYPE"
+ONCE="$DIR/once.$TYPE"
+SERVED="$DIR/served.$TYPE"
+
+[ -f "$IMAGE" ] || "$GENIMAGE" "$TYPE" "$SIZE" "$SIZE" "$IMAGE" || exit 1
+
+# one shot launches, start to finish, in milliseconds
+times=
+for ((i = 0; i < LAUNCHES; i++)); do
+    start=$(date +%s%N)
+    $MPIRUN -np "$RANKS" "$HOMEWORK" --tuning "$TUNING" $OPTIONS "$IMAGE" \
+        "$ONCE" $CHAIN > /dev/null || exit 1
+    times="$times $((($(date +%s%N) - start) / 1000))"
+done
+echo "$times" | awk '{
+    n = split($0, t, " ")
+    for (i = 1; i <= n; i++) for (j = i + 1; j <= n; j++)
+        if (t[j] < t[i]) { x = t[i]; t[i] = t[j]; t[j] = x }
+    printf "one shot: %d launches, p50 %.3f ms, max %.3f ms\n", n,
+        t[int((n + 1) / 2)] / 1000, t[n] / 1000
+}'
+
+# the same job through a warm server
+$MPIRUN -np "$RANKS" "$HOMEWORK" --tuning "$TUNING" $OPTIONS \
+    --serve "$SOCKET" > "$DIR/server.log" 2>&1 &
+server=$!
+printf "served:   "
+"$HWCLIENT" --repeat "$REQUESTS" "$SOCKET" "$IMAGE" "$SERVED" $CHAIN
+status=$?
+"$HWCLIENT" "$SOCKET" stop > /dev/null
+wait $server
+cat "$DIR/server.log"
+
+if [ $status != 0 ] || ! cmp -s "$SERVED" "$ONCE"; then
+    echo "the served output differs from the one shot run" >&2
+    exit 1
+fi
@@ -0,0 +1,353 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pipeline.h"
+#include "stream.h"
+#include "encode.h"
+#include "pnm.h"
+#include "profile.h"
+
+#define SHAPE_FIELDS 4  // type, width, height and maxval
+#define GROUP_FIELDS 4  // group, images, busy and waiting seconds
+
+// the place of this rank in the pipeline and what it did there
+typedef struct {
+    int groups;
+    int groupFirst[MAX_PIPELINE_GROUPS + 1];  // first rank of every group
+    int stageFirst[MAX_PIPELINE_GROUPS + 1];  // first stage of every group
+    int group;
+    int images;
+    double busy;  // seconds filtering
+    double waiting;  // seconds blocked on the neighbour groups
+}pipelineState;
+
+int parsePipeline(const char *text, int *groupRanks) {
+    if (strcmp(text, "auto") == 0) {
+        return AUTO_PIPELINE;
+    }
+
+    int groups = 0;
+    const char *next = text;
+    while (*next != '\0') {
+        char *end;
+        long ranks = strtol(next, &end, 10);
+        if (end == next || ranks < 1 || groups == MAX_PIPELINE_GROUPS ||
+            (*end != ',' && *end != '\0')) {
+            fprintf(stderr, "invalid pipeline groups: %s\n", text);
+            exit(1);
+        }
+        groupRanks[groups++] = (int)ranks;
+        next = *end == ',' ? end + 1 : end;
+    }
+    if (groups == 0) {
+        fprintf(stderr, "invalid pipeline groups: %s\n", text);
+        exit(1);
+    }
+    return groups;
+}
+
+// cut the stages in runs, one per group, and the ranks in groups
+static void layoutGroups(pipelineState *state, const options *opts,
+    int stages, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int ranks = 0;
+    if (opts->pipelineGroups == AUTO_PIPELINE) {
+        state->groups = size < stages ? size : stages;
+        for (int g = 0; g <= state->groups; g++) {
+            state->groupFirst[g] = size * g / state->groups;
+        }
+        ranks = size;
+    } else {
+        state->groups = opts->pipelineGroups;
+        for (int g = 0; g < state->groups; g++) {
+            state->groupFirst[g] = ranks;
+            ranks += opts->groupRanks[g];
+        }
+        state->groupFirst[state->groups] = ranks;
+    }
+    if (ranks != size) {
+        if (rank == 0) {
+            fprintf(stderr, "pipeline groups take %d ranks, not %d\n",
+                ranks, size);
+        }
+        MPI_Abort(comm, 1);
+    }
+
+    // with more groups than stages some groups only pass the rows on
+    for (int g = 0; g <= state->groups; g++) {
+        state->stageFirst[g] = stages * g / state->groups;
+    }
+    state->group = 0;
+    while (state->groupFirst[state->group + 1] <= rank) {
+        state->group++;
+    }
+    state->images = 0;
+    state->busy = 0;
+    state->waiting = 0;
+}
+
+// the rank of a group that takes an image
+static int stageRank(const pipelineState *state, int group, int index) {
+    int ranks = state->groupFirst[group + 1] - state->groupFirst[group];
+
+    return state->groupFirst[group] + index % ranks;
+}
+
+// append a stripe from the group before to the end of a window, returns
+// its rows
+static int receiveStripe(image *window, int source, MPI_Comm comm,
+    pipelineState *state) {
+    MPI_Status status;
+    int rows;
+    double begin = MPI_Wtime();
+
+    // a stripe is sent as one rows type, so it counts in single rows
+    MPI_Datatype rowType = createRowsType(window, 1);
+    MPI_Probe(source, STRIPE_TAG, comm, &status);
+    MPI_Get_count(&status, rowType, &rows);
+    MPI_Type_free(&rowType);
+
+    int row = windowEnd(window);
+    window->rows += rows;
+    MPI_Datatype rowsType = createRowsType(window, rows);
+    MPI_Recv(imageRow(window, 0, row), 1, rowsType, source, STRIPE_TAG, comm,
+        MPI_STATUS_IGNORE);
+    MPI_Type_free(&rowsType);
+    state->waiting += MPI_Wtime() - begin;
+    profilePhase(PHASE_WAIT, begin,
+        (long)rows * window->rowSamples * window->planes);
+    return rows;
+}
+
+static void sendStripe(const image *window, int firstRow, int rows, int dest,
+    MPI_Comm comm, pipelineState *state) {
+    double begin = MPI_Wtime();
+    MPI_Datatype rowsType = createRowsType(window, rows);
+
+    MPI_Send(imageRow(window, 0, firstRow), 1, rowsType, dest, STRIPE_TAG,
+        comm);
+    MPI_Type_free(&rowsType);
+    state->waiting += MPI_Wtime() - begin;
+    profilePhase(PHASE_WAIT, begin,
+        (long)rows * window->rowSamples * window->planes);
+}
+
+// run the stages of this rank's group on one image: the first group reads
+// the input, the last one writes the output and the others take stripes
+// from the group before and hand them to the group after
+static void runImage(const imageJob *job, int index, const options *opts,
+    threadPool *pool, pipelineState *state, MPI_Comm comm) {
+    int group = state->group;
+    int prevRank = group > 0 ? stageRank(state, group - 1, index) :
+        MPI_PROC_NULL;
+    int nextRank = group + 1 < state->groups ?
+        stageRank(state, group + 1, index) : MPI_PROC_NULL;
+
+    // stages past the end of a shorter chain pass the rows on
+    int filterCount = job->filterCount;
+    int first = state->stageFirst[group] < filterCount ?
+        state->stageFirst[group] : filterCount;
+    int last = state->stageFirst[group + 1] < filterCount ?
+        state->stageFirst[group + 1] : filterCount;
+    int filters = last - first;
+
+    // the first group parses the header, the others get the shape
+    image shape;
+    mappedFile input;
+    long dataOffset = 0;
+    int fields[SHAPE_FIELDS];
+    double begin = profileBegin();
+    if (prevRank == MPI_PROC_NULL) {
+        mapFile(job->input, 0, 0, 0, &input);
+        dataOffset = parseHeader(input.bytes, input.fileSize, &shape,
+            opts->layout);
+        requireSamples(&shape);
+        profilePhase(PHASE_HEADER, begin, dataOffset);
+        fields[0] = shape.type;
+        fields[1] = shape.width;
+        fields[2] = shape.height;
+        fields[3] = shape.maxval;
+    } else {
+        double start = MPI_Wtime();
+        MPI_Recv(fields, SHAPE_FIELDS, MPI_INT, prevRank, SHAPE_TAG, comm,
+            MPI_STATUS_IGNORE);
+        state->waiting += MPI_Wtime() - start;
+        profilePhase(PHASE_WAIT, begin, 0);
+        initImage(&shape, fields[0], fields[1], fields[2], fields[3],
+            opts->layout);
+    }
+    if (nextRank != MPI_PROC_NULL) {
+        MPI_Send(fields, SHAPE_FIELDS, MPI_INT, nextRank, SHAPE_TAG, comm);
+    }
+    int height = shape.height;
+    size_t rowBytes = fileRowBytes(&shape);
+
+    // small stripes, so the windows of a stage stay in cache; a stripe grows
+    // by at most the radius of every stage before it
+    int stripeRows = opts->stripeRows > 0 ? opts->stripeRows :
+        PIPELINE_STRIPE_BYTES / rowBytes;
+    stripeRows = stripeRows > 0 ? stripeRows : 1;
+    int maxRadius = 1;
+    for (int s = 0; s < filterCount; s++) {
+        int radius = filterRadius(job->chain[s]);
+        maxRadius = radius > maxRadius ? radius : maxRadius;
+    }
+    int capacity = stripeRows + chainRadius(job, 0, filterCount) +
+        2 * maxRadius;
+    image *windows = (image *)malloc((filters + 1) * sizeof(image));
+    stencil *stencils = (stencil *)malloc(
+        (filters > 0 ? filters : 1) * sizeof(stencil));
+    for (int s = 0; s <= filters; s++) {
+        windows[s] = shape;
+        allocRows(&windows[s], 0, capacity);
+        windows[s].rows = 0;
+    }
+    for (int s = 0; s < filters; s++) {
+        prepareFilter(&stencils[s], job->chain[first + s]);
+    }
+
+    // the stripes come in order, so the output is written as it comes out
+    int fd = -1;
+    // compressed outputs are written raw beside it, then encoded whole
+    char raw[ENCODE_PATH_MAX];
+    int format = outputFormat(job->output);
+    snprintf(raw, ENCODE_PATH_MAX, "%s%s", job->output,
+        format != FORMAT_PNM ? RAW_SUFFIX : "");
+    if (nextRank == MPI_PROC_NULL) {
+        fd = open(raw, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror("error opening output file");
+            MPI_Abort(comm, 1);
+        }
+        writeHeader(fd, &shape);
+    }
+
+    image *output = &windows[filters];
+    while (windowEnd(&windows[0]) < height) {
+        int row = windowEnd(&windows[0]);
+        if (prevRank == MPI_PROC_NULL) {
+            int rows = height - row < stripeRows ? height - row : stripeRows;
+            begin = profileBegin();
+            windows[0].rows += rows;
+            loadRows(&windows[0], row, rows,
+                input.bytes + dataOffset + row * rowBytes);
+            profilePhase(PHASE_READ, begin, (long)rows * rowBytes);
+        } else {
+            receiveStripe(&windows[0], prevRank, comm, state);
+        }
+
+        for (int s = 0; s < filters; s++) {
+            begin = MPI_Wtime();
+            int filtered = runStage(&windows[s], &windows[s + 1], capacity,
+                &stencils[s], job->chain[first + s]->conv, pool);
+            state->busy += MPI_Wtime() - begin;
+            profileFilter(job->chain[first + s], begin,
+                (long)filtered * shape.rowSamples * shape.planes);
+        }
+
+        int low = output->firstRow;
+        int high = windowEnd(output);
+        if (low < high && nextRank == MPI_PROC_NULL) {
+            begin = profileBegin();
+            writeRows(fd, output, low, high - low);
+            profilePhase(PHASE_WRITE, begin, (long)(high - low) * rowBytes);
+        } else if (low < high) {
+            sendStripe(output, low, high - low, nextRank, comm, state);
+        }
+        slideWindow(output, high);
+    }
+
+    if (prevRank == MPI_PROC_NULL) {
+        unmapFile(&input);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (fd >= 0 && format != FORMAT_PNM) {
+        encodeFile(raw, job->output, opts, pool, MPI_COMM_SELF);
+    }
+    for (int s = 0; s <= filters; s++) {
+        freeImage(&windows[s]);
+    }
+    free(windows);
+    free(stencils);
+    state->images++;
+}
+
+// rank 0 prints how much of the run every group spent filtering
+static void reportOccupancy(const pipelineState *state, double elapsed,
+    MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    double fields[GROUP_FIELDS] = {state->group, state->images, state->busy,
+        state->waiting};
+    double *all = NULL;
+    if (rank == 0) {
+        all = (double *)malloc(size * GROUP_FIELDS * sizeof(double));
+    }
+    MPI_Gather(fields, GROUP_FIELDS, MPI_DOUBLE, all, GROUP_FIELDS,
+        MPI_DOUBLE, 0, comm);
+    double slowest;
+    MPI_Reduce(&elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    if (rank != 0) {
+        return;
+    }
+
+    for (int g = 0; g < state->groups; g++) {
+        int ranks = state->groupFirst[g + 1] - state->groupFirst[g];
+        int images = 0;
+        double busy = 0;
+        double waiting = 0;
+        for (int r = state->groupFirst[g]; r < state->groupFirst[g + 1];
+            r++) {
+            images += (int)all[r * GROUP_FIELDS + 1];
+            busy += all[r * GROUP_FIELDS + 2];
+            waiting += all[r * GROUP_FIELDS + 3];
+        }
+        double span = slowest > 0 ? ranks * slowest : 1;
+        if (state->stageFirst[g] == state->stageFirst[g + 1]) {
+            printf("stage group %d, no filters", g);
+        } else if (state->stageFirst[g] + 1 == state->stageFirst[g + 1]) {
+            printf("stage group %d, filter %d", g, state->stageFirst[g + 1]);
+        } else {
+            printf("stage group %d, filters %d-%d", g,
+                state->stageFirst[g] + 1, state->stageFirst[g + 1]);
+        }
+        printf(", %d ranks: %d images, %.0f%% busy, %.0f%% waiting\n",
+            ranks, images, 100 * busy / span, 100 * waiting / span);
+    }
+    free(all);
+}
+
+void pipelineImages(const imageJob *jobs, int count, const options *opts,
+    threadPool *pool, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    // one stage per filter of the longest chain
+    int stages = 1;
+    for (int i = 0; i < count; i++) {
+        stages = jobs[i].filterCount > stages ? jobs[i].filterCount : stages;
+    }
+    pipelineState state;
+    layoutGroups(&state, opts, stages, comm);
+
+    // every rank of a group takes the images in turn, in order, so the
+    // messages between two groups never wait on a later image
+    MPI_Barrier(comm);
+    double start = MPI_Wtime();
+    for (int i = 0; i < count; i++) {
+        if (stageRank(&state, state.group, i) == rank) {
+            runImage(&jobs[i], i, opts, pool, &state, comm);
+        }
+    }
+    reportOccupancy(&state, MPI_Wtime() - start, comm);
+}
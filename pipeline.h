@@ -0,0 +1,28 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <mpi.h>
+
+#include "process.h"
+
+#define NO_PIPELINE 0
+#define AUTO_PIPELINE -1
+#define PIPELINE_STRIPE_BYTES (256 << 10)  // samples per stripe, about an L2
+
+#define SHAPE_TAG 6
+#define STRIPE_TAG 7
+
+// the ranks of every group in "2,1,1", or AUTO_PIPELINE for "auto";
+// returns the number of groups, exits on a bad list
+int parsePipeline(const char *text, int *groupRanks);
+
+// filter the images of jobs as a pipeline: stage s applies filter s of
+// every chain, the stages are cut into opts->pipelineGroups runs of rank
+// groups (AUTO_PIPELINE for one per stage, as far as the ranks go) and the
+// ranks of a group take the images in turn. Stripes of rows go from group
+// to group as soon as a stage can filter them, so several images are in
+// flight at once; rank 0 prints the occupancy of every group
+void pipelineImages(const imageJob *jobs, int count, const options *opts,
+    threadPool *pool, MPI_Comm comm);
+
+#endif
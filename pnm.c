@@ -0,0 +1,354 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "pnm.h"
+
+#define WRITE_CHUNK (1 << 20)  // bytes interleaved before each write
+#define WRITE_IOVECS 1024  // rows handed to one writev
+
+void mapFile(const char *fileName, long offset, size_t length, int writable,
+    mappedFile *map) {
+    int fd = open(fileName, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        perror(fileName);
+        exit(1);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        perror(fileName);
+        exit(1);
+    }
+    map->fileSize = (size_t)info.st_size;
+    if (length == 0) {
+        length = map->fileSize > (size_t)offset ? map->fileSize - offset : 0;
+    }
+
+    // mmap wants a page aligned offset, map from the page holding it
+    long pageSize = sysconf(_SC_PAGESIZE);
+    long skip = offset % pageSize;
+    map->length = length + skip;
+    map->base = NULL;
+    map->bytes = NULL;
+    if (length > 0) {
+        int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        map->base = mmap(NULL, map->length, protection, MAP_SHARED, fd,
+            offset - skip);
+        if (map->base == MAP_FAILED) {
+            perror("error mapping file");
+            exit(1);
+        }
+        if (!writable) {
+            madvise(map->base, map->length, MADV_SEQUENTIAL);
+        }
+        map->bytes = (unsigned char *)map->base + skip;
+    }
+    close(fd);
+}
+
+void unmapFile(mappedFile *map) {
+    if (map->base != NULL) {
+        munmap(map->base, map->length);
+    }
+    map->base = NULL;
+    map->bytes = NULL;
+}
+
+// skip whitespace and comments, a comment runs from # to the end of the line
+static size_t skipSpace(const unsigned char *bytes, size_t size, size_t at) {
+    while (at < size) {
+        if (bytes[at] == '#') {
+            while (at < size && bytes[at] != '\n' && bytes[at] != '\r') {
+                at++;
+            }
+        } else if (isspace(bytes[at])) {
+            at++;
+        } else {
+            break;
+        }
+    }
+    return at;
+}
+
+// a header field, -1 with the reason in error when missing or too large
+static int parseNumber(const unsigned char *bytes, size_t size, size_t *at,
+    const char *field, char *error, size_t errorSize) {
+    long value = 0;
+
+    *at = skipSpace(bytes, size, *at);
+    if (*at == size || !isdigit(bytes[*at])) {
+        snprintf(error, errorSize, "invalid PNM header: missing %s", field);
+        return -1;
+    }
+    while (*at < size && isdigit(bytes[*at])) {
+        value = value * 10 + (bytes[*at] - '0');
+        if (value > INT_MAX) {
+            snprintf(error, errorSize, "invalid PNM header: %s too large",
+                field);
+            return -1;
+        }
+        (*at)++;
+    }
+    return (int)value;
+}
+
+long scanHeader(const unsigned char *bytes, size_t size, image *img,
+    int layout, char *error, size_t errorSize) {
+    if (size < 2 || bytes[0] != 'P' || (bytes[1] != '5' && bytes[1] != '6')) {
+        snprintf(error, errorSize, "invalid PNM header: only binary P5 and "
+            "P6 images are supported");
+        return -1;
+    }
+
+    size_t at = 2;
+    int width = parseNumber(bytes, size, &at, "width", error, errorSize);
+    int height = width < 0 ? -1 :
+        parseNumber(bytes, size, &at, "height", error, errorSize);
+    int maxval = height < 0 ? -1 :
+        parseNumber(bytes, size, &at, "maxval", error, errorSize);
+    if (maxval < 0) {
+        return -1;
+    }
+
+    // exactly one whitespace byte separates maxval from the samples
+    if (at == size || !isspace(bytes[at])) {
+        snprintf(error, errorSize, "invalid PNM header: no whitespace after "
+            "maxval");
+        return -1;
+    }
+    at++;
+
+    if (width < 1 || height < 1) {
+        snprintf(error, errorSize, "invalid PNM header: empty image");
+        return -1;
+    }
+    if (maxval < 1 || maxval > PNM_MAXVAL_MAX) {
+        snprintf(error, errorSize, "invalid PNM header: maxval out of range");
+        return -1;
+    }
+    int type = bytes[1] == '5' ? BW : COLOR;
+    if (width > INT_MAX / IMAGE_SIZE_COL - IMAGE_ALIGNMENT) {
+        snprintf(error, errorSize, "invalid PNM header: width too large");
+        return -1;
+    }
+
+    initImage(img, type, width, height, maxval, layout);
+    if ((size - at) / (fileRowBytes(img) * sampleBytes(img)) <
+        (size_t)height) {
+        snprintf(error, errorSize, "truncated PNM image: %d rows expected",
+            height);
+        return -1;
+    }
+    return (long)at;
+}
+
+long parseHeader(const unsigned char *bytes, size_t size, image *img,
+    int layout) {
+    char error[PNM_ERROR_MAX];
+    long dataOffset = scanHeader(bytes, size, img, layout, error,
+        sizeof(error));
+
+    if (dataOffset < 0) {
+        fprintf(stderr, "%s\n", error);
+        exit(1);
+    }
+    return dataOffset;
+}
+
+int checkSamples(const image *img, char *error, size_t errorSize) {
+    if (img->maxval > PNM_MAXVAL_8BIT) {
+        snprintf(error, errorSize, "16-bit PNM images (maxval %d) are not "
+            "supported by the filters", img->maxval);
+        return 0;
+    }
+    return 1;
+}
+
+void requireSamples(const image *img) {
+    char error[PNM_ERROR_MAX];
+
+    if (!checkSamples(img, error, sizeof(error))) {
+        fprintf(stderr, "%s\n", error);
+        exit(1);
+    }
+}
+
+int sampleBytes(const image *img) {
+    return img->maxval > PNM_MAXVAL_8BIT ? 2 : 1;
+}
+
+int formatHeader(const image *img, char *header) {
+    return snprintf(header, HEADER_MAX, "P%d\n%d %d\n%d\n",
+        img->type == BW ? 5 : 6, img->width, img->height, img->maxval);
+}
+
+size_t fileRowBytes(const image *img) {
+    return (size_t)img->width * img->channels;
+}
+
+void loadTile(image *img, int firstRow, int rows, int firstColumn,
+    int columns, const unsigned char *payload, size_t payloadStride) {
+    size_t bytes = (size_t)columns * img->channels;
+
+    for (int i = 0; i < rows; i++) {
+        const unsigned char *pixels = payload + i * payloadStride;
+
+        if (img->layout == INTERLEAVED) {
+            memcpy(imageRow(img, 0, firstRow + i) + firstColumn * img->step,
+                pixels, bytes);
+            continue;
+        }
+        // split every pixel over the planes
+        for (int p = 0; p < img->planes; p++) {
+            unsigned char *plane = imageRow(img, p, firstRow + i) + firstColumn;
+            for (int j = 0; j < columns; j++) {
+                plane[j] = pixels[img->channels * j + p];
+            }
+        }
+    }
+}
+
+void storeTile(const image *img, int firstRow, int rows, int firstColumn,
+    int columns, unsigned char *payload, size_t payloadStride) {
+    size_t bytes = (size_t)columns * img->channels;
+
+    for (int i = 0; i < rows; i++) {
+        unsigned char *pixels = payload + i * payloadStride;
+
+        if (img->layout == INTERLEAVED) {
+            memcpy(pixels, imageRow(img, 0, firstRow + i)
+                + firstColumn * img->step, bytes);
+            continue;
+        }
+        // put every pixel back together
+        for (int p = 0; p < img->planes; p++) {
+            const unsigned char *plane = imageRow(img, p, firstRow + i)
+                + firstColumn;
+            for (int j = 0; j < columns; j++) {
+                pixels[img->channels * j + p] = plane[j];
+            }
+        }
+    }
+}
+
+void loadRows(image *img, int firstRow, int rows,
+    const unsigned char *payload) {
+    if (img->layout == PLANAR) {  // whole rows split faster
+        for (int i = 0; i < rows; i++) {
+            deinterleaveRow(img, firstRow + i, payload + i * fileRowBytes(img));
+        }
+        return;
+    }
+    loadTile(img, firstRow, rows, 0, img->width, payload, fileRowBytes(img));
+}
+
+void storeRows(const image *img, int firstRow, int rows,
+    unsigned char *payload) {
+    if (img->layout == PLANAR) {
+        for (int i = 0; i < rows; i++) {
+            interleaveRow(img, firstRow + i, payload + i * fileRowBytes(img));
+        }
+        return;
+    }
+    storeTile(img, firstRow, rows, 0, img->width, payload, fileRowBytes(img));
+}
+
+void writeFully(int fd, const void *buffer, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)buffer;
+
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0) {
+            perror("error writing output file");
+            exit(1);
+        }
+        bytes += written;
+        size -= written;
+    }
+}
+
+// writev every vector, picking up after short writes
+static void writeVectors(int fd, struct iovec *vectors, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, vectors, count);
+        if (written < 0) {
+            perror("error writing output file");
+            exit(1);
+        }
+        while (count > 0 && (size_t)written >= vectors->iov_len) {
+            written -= vectors->iov_len;
+            vectors++;
+            count--;
+        }
+        if (count > 0) {
+            vectors->iov_base = (unsigned char *)vectors->iov_base + written;
+            vectors->iov_len -= written;
+        }
+    }
+}
+
+long writeHeader(int fd, const image *img) {
+    char header[HEADER_MAX];
+    int headerSize = formatHeader(img, header);
+
+    writeFully(fd, header, headerSize);
+    return headerSize;
+}
+
+void writeRows(int fd, const image *img, int firstRow, int rows) {
+    size_t rowBytes = fileRowBytes(img);
+
+    if (img->layout == INTERLEAVED) {  // the rows themselves, padding skipped
+        struct iovec vectors[WRITE_IOVECS];
+
+        for (int i = 0; i < rows; i += WRITE_IOVECS) {
+            int count = rows - i < WRITE_IOVECS ? rows - i : WRITE_IOVECS;
+            for (int j = 0; j < count; j++) {
+                vectors[j].iov_base = imageRow(img, 0, firstRow + i + j);
+                vectors[j].iov_len = rowBytes;
+            }
+            writeVectors(fd, vectors, count);
+        }
+    } else {  // interleave a chunk of rows at a time
+        int chunkRows = WRITE_CHUNK / rowBytes > 0 ? WRITE_CHUNK / rowBytes : 1;
+        unsigned char *buffer = (unsigned char *)malloc(chunkRows * rowBytes);
+
+        for (int i = 0; i < rows; i += chunkRows) {
+            int count = rows - i < chunkRows ? rows - i : chunkRows;
+            storeRows(img, firstRow + i, count, buffer);
+            writeFully(fd, buffer, count * rowBytes);
+        }
+        free(buffer);
+    }
+}
+
+void readInput(const char *fileName, image *img, int layout) {
+    mappedFile map;
+
+    mapFile(fileName, 0, 0, 0, &map);
+    long dataOffset = parseHeader(map.bytes, map.fileSize, img, layout);
+    requireSamples(img);
+    allocRows(img, 0, img->height);
+    loadRows(img, 0, img->height, map.bytes + dataOffset);
+    unmapFile(&map);
+}
+
+void writeData(const char *fileName, image *img) {
+    int fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("error opening output file");
+        exit(1);
+    }
+
+    writeHeader(fd, img);
+    writeRows(fd, img, img->firstRow, img->rows);
+    close(fd);
+}
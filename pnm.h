@@ -0,0 +1,70 @@
+#ifndef PNM_H
+#define PNM_H
+
+#include <stddef.h>
+
+#include "image.h"
+
+#define PNM_MAXVAL_8BIT 255
+#define PNM_MAXVAL_MAX 65535
+#define PNM_ERROR_MAX 256  // longest reason scanHeader gives
+
+// a window of a file mapped into memory
+typedef struct {
+    void *base;  // page aligned start of the mapping
+    size_t length;  // bytes mapped from base
+    unsigned char *bytes;  // the first byte asked for
+    size_t fileSize;
+}mappedFile;
+
+// map length bytes at offset, length 0 maps up to the end of the file;
+// writable maps are shared, so stores reach the file
+void mapFile(const char *fileName, long offset, size_t length, int writable,
+    mappedFile *map);
+void unmapFile(mappedFile *map);
+
+// parse a P5 or P6 header from the first size bytes of a file, comments
+// and any whitespace included; fills in the shape and returns the payload
+// offset. Samples of a maxval past 255 take two big endian bytes. Returns
+// -1 with the reason in error on malformed or truncated images
+long scanHeader(const unsigned char *bytes, size_t size, image *img,
+    int layout, char *error, size_t errorSize);
+// scanHeader, exiting on an error
+long parseHeader(const unsigned char *bytes, size_t size, image *img,
+    int layout);
+// bytes of one sample in the file, 2 for 16-bit images
+int sampleBytes(const image *img);
+// whether the filters take the samples of img, 8-bit ones; if not, the
+// reason goes in error
+int checkSamples(const image *img, char *error, size_t errorSize);
+// checkSamples, exiting on 16-bit images
+void requireSamples(const image *img);
+// the header writeHeader produces, returns its length
+int formatHeader(const image *img, char *header);
+
+// bytes of one row of 8-bit samples in the file
+size_t fileRowBytes(const image *img);
+
+// the columns [firstColumn, firstColumn + columns) of stored rows from and
+// to a payload holding them payloadStride bytes apart
+void loadTile(image *img, int firstRow, int rows, int firstColumn,
+    int columns, const unsigned char *payload, size_t payloadStride);
+void storeTile(const image *img, int firstRow, int rows, int firstColumn,
+    int columns, unsigned char *payload, size_t payloadStride);
+// whole stored rows from and to a payload holding them back to back
+void loadRows(image *img, int firstRow, int rows,
+    const unsigned char *payload);
+void storeRows(const image *img, int firstRow, int rows,
+    unsigned char *payload);
+
+// write everything or exit, retrying short writes
+void writeFully(int fd, const void *buffer, size_t size);
+long writeHeader(int fd, const image *img);
+// rows go out in few large writev calls, straight from the padded rows
+void writeRows(int fd, const image *img, int firstRow, int rows);
+
+// whole files
+void readInput(const char *fileName, image *img, int layout);
+void writeData(const char *fileName, image *img);
+
+#endif
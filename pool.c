@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+typedef struct {
+    threadPool *pool;
+    int id;
+    int pin;
+}workerArg;
+
+// pin the calling thread to the index-th cpu of the process affinity mask,
+// which mpirun may already have narrowed to a socket or numa domain
+static void pinThread(int index) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+
+    int count = CPU_COUNT(&allowed);
+    int wanted = index % count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && wanted-- == 0) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+            return;
+        }
+    }
+}
+
+int availableCpus(void) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return 1;
+    }
+    return CPU_COUNT(&allowed);
+}
+
+static void *workerLoop(void *data) {
+    workerArg *worker = (workerArg *)data;
+    threadPool *pool = worker->pool;
+    int id = worker->id;
+
+    if (worker->pin) {
+        pinThread(id);
+    }
+    free(worker);
+
+    while (1) {
+        pthread_barrier_wait(&pool->start);
+        if (pool->stop) {
+            break;
+        }
+        if (id < pool->active) {
+            pool->task(pool->arg, id, pool->active);
+        }
+        pthread_barrier_wait(&pool->done);
+    }
+    return NULL;
+}
+
+void startPool(threadPool *pool, int threads, int pin) {
+    pool->threads = threads > 0 ? threads : 1;
+    pool->active = pool->threads;
+    pool->stop = 0;
+    pool->task = NULL;
+    pool->arg = NULL;
+    pool->workers = (pthread_t *)malloc(pool->threads * sizeof(pthread_t));
+    pthread_barrier_init(&pool->start, NULL, pool->threads);
+    pthread_barrier_init(&pool->done, NULL, pool->threads);
+
+    // workers inherit the full affinity mask, worker 0 narrows its own last
+    for (int i = 1; i < pool->threads; i++) {
+        workerArg *arg = (workerArg *)malloc(sizeof(workerArg));
+        arg->pool = pool;
+        arg->id = i;
+        arg->pin = pin;
+        if (pthread_create(&pool->workers[i], NULL, workerLoop, arg) != 0) {
+            perror("error starting worker thread");
+            exit(1);
+        }
+    }
+    if (pin && pool->threads > 1) {
+        pinThread(0);
+    }
+}
+
+void runPool(threadPool *pool, poolTask task, void *arg) {
+    if (pool->active == 1) {
+        task(arg, 0, 1);
+        return;
+    }
+
+    pool->task = task;
+    pool->arg = arg;
+    pthread_barrier_wait(&pool->start);
+    task(arg, 0, pool->active);
+    pthread_barrier_wait(&pool->done);
+}
+
+void setPoolThreads(threadPool *pool, int threads) {
+    pool->active = threads < 1 ? 1 : threads < pool->threads ? threads :
+        pool->threads;
+}
+
+void stopPool(threadPool *pool) {
+    if (pool->threads > 1) {
+        pool->stop = 1;
+        pthread_barrier_wait(&pool->start);
+        for (int i = 1; i < pool->threads; i++) {
+            pthread_join(pool->workers[i], NULL);
+        }
+    }
+    pthread_barrier_destroy(&pool->start);
+    pthread_barrier_destroy(&pool->done);
+    free(pool->workers);
+}
+
+void splitRange(int low, int high, int thread, int threads, int *first,
+    int *last) {
+    int count = high > low ? high - low : 0;
+    int share = count / threads;
+    int extra = count % threads;
+
+    *first = low + thread * share + (thread < extra ? thread : extra);
+    *last = *first + share + (thread < extra ? 1 : 0);
+}
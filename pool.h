@@ -0,0 +1,37 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+// one share of a task, thread is in [0, threads)
+typedef void (*poolTask)(void *arg, int thread, int threads);
+
+// persistent workers; the calling thread is worker 0 and the only one
+// talking to MPI
+typedef struct {
+    int threads;
+    int active;  // threads a task is split over, the others sit it out
+    pthread_t *workers;
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+    poolTask task;
+    void *arg;
+    int stop;
+}threadPool;
+
+// start threads - 1 workers, pinned to the cpus this process may run on
+void startPool(threadPool *pool, int threads, int pin);
+// run task on every thread and wait for all of them
+void runPool(threadPool *pool, poolTask task, void *arg);
+// split the next tasks over threads of the workers, at most all of them
+void setPoolThreads(threadPool *pool, int threads);
+void stopPool(threadPool *pool);
+
+// cpus this process may run on
+int availableCpus(void);
+
+// split [low, high) in threads shares and return share thread
+void splitRange(int low, int high, int thread, int threads, int *first,
+    int *last);
+
+#endif
@@ -0,0 +1,513 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "process.h"
+#include "bandio.h"
+#include "stream.h"
+#include "steal.h"
+#include "shared.h"
+#include "pipeline.h"
+#include "cache.h"
+#include "encode.h"
+#include "tune.h"
+#include "tile.h"
+#include "pnm.h"
+#include "profile.h"
+
+#define HALO_MESSAGES 4  // a send and a receive per neighbour
+#define OVERLAP_CHUNKS 4  // interior pieces, MPI is polled between them
+
+// the halo messages of a band, set up once and restarted after every block
+typedef struct {
+    MPI_Request requests[HALO_MESSAGES];
+    int count;
+    MPI_Datatype rowsType;
+}haloRequests;
+
+// compute the [rowLow, rowHigh) band of rows owned by a process
+void computeBand(int height, int rank, int size, int *rowLow, int *rowHigh) {
+    int rowsPerRank = height / size;
+    int extraRows = height % size;
+
+    *rowLow = rank * rowsPerRank + (rank < extraRows ? rank : extraRows);
+    *rowHigh = *rowLow + rowsPerRank + (rank < extraRows ? 1 : 0);
+}
+
+// apply a 3x3 filter on the rows [rowLow, rowHigh) of every plane
+void applyFilter(image *dst, image *src, int rowLow, int rowHigh,
+    const stencil *st) {
+    // do not touch border pixels
+    int firstLine = rowLow > 1 ? rowLow : 1;
+    int lastLine = rowHigh < src->height - 1 ? rowHigh : src->height - 1;
+    int step = src->step;
+
+    for (int p = 0; p < src->planes; p++) {
+        for (int line = firstLine; line < lastLine; line++) {
+            filterRow(imageRow(dst, p, line), imageRow(src, p, line - 1),
+                imageRow(src, p, line), imageRow(src, p, line + 1), step,
+                src->rowSamples - step, step, st);
+        }
+    }
+}
+
+// copy the job rows of every plane from src to dst, one share per thread
+void copyRowsTask(void *arg, int thread, int threads) {
+    passJob *job = (passJob *)arg;
+    int first, last;
+
+    splitRange(job->rowLow, job->rowHigh, thread, threads, &first, &last);
+    for (int p = 0; p < job->src->planes && first < last; p++) {
+        memcpy(imageRow(job->dst, p, first), imageRow(job->src, p, first),
+            (last - first) * job->src->stride);
+    }
+}
+
+// copy what no filter writes: the image top and bottom rows and the first
+// and last pixel of every other row
+void copyBordersTask(void *arg, int thread, int threads) {
+    passJob *job = (passJob *)arg;
+    const image *src = job->src;
+    int step = src->step;
+    int first, last;
+
+    splitRange(job->rowLow, job->rowHigh, thread, threads, &first, &last);
+    for (int p = 0; p < src->planes; p++) {
+        for (int line = first; line < last; line++) {
+            unsigned char *out = imageRow(job->dst, p, line);
+            const unsigned char *in = imageRow(src, p, line);
+
+            if (line == 0 || line == src->height - 1) {
+                memcpy(out, in, src->rowSamples);
+                continue;
+            }
+            memcpy(out, in, step);
+            memcpy(out + src->rowSamples - step, in + src->rowSamples - step,
+                step);
+        }
+    }
+}
+
+// filter the job rows, one share per thread
+void applyFilterTask(void *arg, int thread, int threads) {
+    passJob *job = (passJob *)arg;
+    int first, last;
+
+    splitRange(job->rowLow, job->rowHigh, thread, threads, &first, &last);
+    if (first < last && job->conv != NULL) {
+        convolveRows(job->dst, job->src, first, last, job->conv);
+    } else if (first < last) {
+        applyFilter(job->dst, job->src, first, last, job->st);
+    }
+}
+
+// swap the depth edge rows of a band with the neighbour bands
+void exchangeHalo(image *img, int rowLow, int rowHigh, int depth,
+    int prevRank, int nextRank, MPI_Comm comm) {
+    // the edge bands have no neighbour on one side, send and receive nothing
+    int upperCount = prevRank != MPI_PROC_NULL ? 1 : 0;
+    int lowerCount = nextRank != MPI_PROC_NULL ? 1 : 0;
+    unsigned char *upperGhost = imageRow(img, 0, upperCount ? rowLow - depth : rowLow);
+    unsigned char *lowerGhost = imageRow(img, 0, lowerCount ? rowHigh : rowLow);
+    MPI_Datatype rowsType = createRowsType(img, depth);
+    double begin = profileBegin();
+
+    // first rows go up, the lower ghost rows come from below
+    MPI_Sendrecv(imageRow(img, 0, rowLow), upperCount, rowsType, prevRank,
+        HALO_TAG, lowerGhost, lowerCount, rowsType, nextRank, HALO_TAG,
+        comm, MPI_STATUS_IGNORE);
+    // last rows go down, the upper ghost rows come from above
+    MPI_Sendrecv(imageRow(img, 0, rowHigh - depth), lowerCount, rowsType,
+        nextRank, HALO_TAG, upperGhost, upperCount, rowsType, prevRank,
+        HALO_TAG, comm, MPI_STATUS_IGNORE);
+    MPI_Type_free(&rowsType);
+    profilePhase(PHASE_HALO, begin,
+        (long)(upperCount + lowerCount) * depth * img->rowSamples * img->planes);
+}
+
+int haloLimit(int height, int size) {
+    // a ghost region deeper than a neighbour band would span several ranks
+    int activeRanks = size < height ? size : height;
+
+    return activeRanks > 1 ? height / activeRanks : INT_MAX;
+}
+
+int chainRadius(const imageJob *job, int first, int last) {
+    int rows = 0;
+
+    for (int i = first; i < last; i++) {
+        rows += filterRadius(job->chain[i]);
+    }
+    return rows;
+}
+
+int widestRadius(const imageJob *job) {
+    int radius = 0;
+
+    for (int i = 0; i < job->filterCount; i++) {
+        int rows = filterRadius(job->chain[i]);
+        radius = rows > radius ? rows : radius;
+    }
+    return radius;
+}
+
+int radiusRanks(const imageJob *job, int length, int size) {
+    int radius = widestRadius(job);
+    int ranks = size;
+
+    while (ranks > 1 && haloLimit(length, ranks) < radius) {
+        ranks--;
+    }
+    return ranks;
+}
+
+int nextBlock(const imageJob *job, int blockStart, int depth, int limit) {
+    int end = blockStart + 1;
+
+    // radiusRanks keeps every filter within the thinnest band
+    if (filterRadius(job->chain[blockStart]) > limit) {
+        fprintf(stderr, "%s reads %d rows past a band of %d\n",
+            job->chain[blockStart]->name,
+            filterRadius(job->chain[blockStart]), limit);
+        exit(1);
+    }
+    // large kernels make for shorter blocks
+    while (end < job->filterCount && end - blockStart < depth &&
+        chainRadius(job, blockStart, end + 1) <= limit) {
+        end++;
+    }
+    return end;
+}
+
+// pick how many filters run between two halo exchanges
+int chooseBlockDepth(int requested, int filterCount, int height, int size) {
+    int activeRanks = size < height ? size : height;
+    int maxDepth = height / activeRanks;
+
+    if (activeRanks == 1) {  // nobody to talk to, run the chain in one go
+        return filterCount > 0 ? filterCount : 1;
+    }
+
+    int depth = requested;
+    if (requested == AUTO_BLOCK) {
+        // every extra filter in a block recomputes two more rows per side,
+        // stop once that redundant work gets past a few percent of a band
+        depth = 1 + maxDepth * MAX_REDUNDANT_PERCENT / 100;
+        if (depth > MAX_BLOCK_DEPTH) {
+            depth = MAX_BLOCK_DEPTH;
+        }
+    }
+    if (depth > maxDepth) {
+        depth = maxDepth;
+    }
+    if (depth > filterCount) {
+        depth = filterCount;
+    }
+    return depth > 0 ? depth : 1;
+}
+
+// persistent sends of the depth edge rows of a band and receives of the
+// ghost rows, always depth deep: a shorter last block reads fewer of them
+static void initHalo(haloRequests *halo, image *img, int rowLow, int rowHigh,
+    int depth, int prevRank, int nextRank, MPI_Comm comm) {
+    halo->rowsType = createRowsType(img, depth);
+    halo->count = 0;
+
+    if (prevRank != MPI_PROC_NULL) {
+        MPI_Recv_init(imageRow(img, 0, rowLow - depth), 1, halo->rowsType,
+            prevRank, HALO_TAG, comm, &halo->requests[halo->count++]);
+        MPI_Send_init(imageRow(img, 0, rowLow), 1, halo->rowsType,
+            prevRank, HALO_TAG, comm, &halo->requests[halo->count++]);
+    }
+    if (nextRank != MPI_PROC_NULL) {
+        MPI_Recv_init(imageRow(img, 0, rowHigh), 1, halo->rowsType,
+            nextRank, HALO_TAG, comm, &halo->requests[halo->count++]);
+        MPI_Send_init(imageRow(img, 0, rowHigh - depth), 1, halo->rowsType,
+            nextRank, HALO_TAG, comm, &halo->requests[halo->count++]);
+    }
+}
+
+static void freeHalo(haloRequests *halo) {
+    for (int i = 0; i < halo->count; i++) {
+        MPI_Request_free(&halo->requests[i]);
+    }
+    MPI_Type_free(&halo->rowsType);
+}
+
+// last filter of a block: the edge rows the neighbours wait for go first,
+// their messages leave while the interior rows are filtered
+static void filterAndSend(passJob *job, int depth, haloRequests *halo,
+    threadPool *pool) {
+    int rowLow = job->rowLow;
+    int rowHigh = job->rowHigh;
+    int flag;
+
+    if (rowHigh - rowLow <= 2 * depth) {  // nothing left to overlap
+        runPool(pool, applyFilterTask, job);
+        MPI_Startall(halo->count, halo->requests);
+        return;
+    }
+
+    job->rowHigh = rowLow + depth;
+    runPool(pool, applyFilterTask, job);
+    job->rowLow = rowHigh - depth;
+    job->rowHigh = rowHigh;
+    runPool(pool, applyFilterTask, job);
+    MPI_Startall(halo->count, halo->requests);
+
+    // poll between pieces, so the messages move without a progress thread
+    int interior = rowHigh - rowLow - 2 * depth;
+    for (int chunk = 0; chunk < OVERLAP_CHUNKS; chunk++) {
+        job->rowLow = rowLow + depth + interior * chunk / OVERLAP_CHUNKS;
+        job->rowHigh = rowLow + depth + interior * (chunk + 1) / OVERLAP_CHUNKS;
+        runPool(pool, applyFilterTask, job);
+        MPI_Testall(halo->count, halo->requests, &flag, MPI_STATUSES_IGNORE);
+    }
+}
+
+// the last pass of a compressed output: every thread filters a stripe,
+// then deflates it while its rows are still in cache
+typedef struct {
+    passJob *pass;
+    bandEncoder *enc;
+}encodePassJob;
+
+static void filterEncodeTask(void *arg, int thread, int threads) {
+    encodePassJob *job = (encodePassJob *)arg;
+    bandEncoder *enc = job->enc;
+    int first, last;
+
+    splitRange(0, enc->stripeCount, thread, threads, &first, &last);
+    for (int stripe = first; stripe < last; stripe++) {
+        passJob rows = *job->pass;
+        rows.rowLow = enc->rowLow + stripe * enc->stripeRows;
+        rows.rowHigh = rows.rowLow + enc->stripeRows < enc->rowHigh ?
+            rows.rowLow + enc->stripeRows : enc->rowHigh;
+        applyFilterTask(&rows, 0, 1);
+        encodeStripe(enc, rows.dst, stripe, thread);
+    }
+}
+
+void processImage(const imageJob *job, const options *opts, threadPool *pool,
+    MPI_Comm comm) {
+    // only bands encode their own rows, the other modes write raw ones
+    int format = outputFormat(job->output);
+    if (format != FORMAT_PNM && (opts->cacheDir != NULL ||
+        opts->pipelineGroups != NO_PIPELINE || opts->stripeRows != NO_STREAM ||
+        opts->stealRows != NO_STEAL || opts->shared || opts->tiles)) {
+        compressedImage(job, opts, pool, comm);
+        return;
+    }
+    if (opts->cacheDir != NULL && job->filterCount > 0) {  // resume a prefix
+        cachedImage(job, opts, pool, comm);
+        return;
+    }
+    if (opts->pipelineGroups != NO_PIPELINE) {  // filters on rank groups
+        pipelineImages(job, 1, opts, pool, comm);
+        return;
+    }
+    if (opts->tuned != NULL) {  // the settings tuned for this class of image
+        tunedImage(job, opts, pool, comm);
+        return;
+    }
+    if (opts->stripeRows != NO_STREAM) {  // rows go through in stripes
+        streamImage(job, opts, pool, comm);
+        return;
+    }
+    if (opts->stealRows != NO_STEAL) {  // chunks shared out while running
+        stealImage(job, opts, pool, comm);
+        return;
+    }
+    if (opts->shared) {  // one copy of the image per node
+        sharedImage(job, opts, pool, comm);
+        return;
+    }
+    if (opts->tiles) {  // a 2D grid of tiles
+        tileImage(job, opts, pool, comm);
+        return;
+    }
+
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // read the image header once, on the leader
+    image givenImage;
+    double begin = profileBegin();
+    long dataOffset = shareHeader(job->input, &givenImage, opts->layout, comm);
+    profilePhase(PHASE_HEADER, begin, dataOffset);
+
+    // a kernel reaching past the thinnest band would need the ghost rows of
+    // several neighbours, the image goes to fewer, thicker bands instead
+    int ranks = radiusRanks(job, givenImage.height, size);
+    if (ranks < size) {
+        MPI_Comm group;
+        MPI_Comm_split(comm, rank < ranks ? 0 : MPI_UNDEFINED, rank, &group);
+        if (group != MPI_COMM_NULL) {
+            processImage(job, opts, pool, group);
+            MPI_Comm_free(&group);
+        }
+        return;
+    }
+
+    // exchange a halo as deep as the block once, then run the whole block
+    int filterCount = job->filterCount;
+    int blockDepth = chooseBlockDepth(opts->blockDepth, filterCount,
+        givenImage.height, size);
+
+    // every filter reads its radius of rows past the band, so the halo of a
+    // block is as deep as their radii together; the buffers fit the deepest
+    int limit = haloLimit(givenImage.height, size);
+    int haloRows = 0;
+    for (int blockStart = 0, blockEnd; blockStart < filterCount;
+        blockStart = blockEnd) {
+        blockEnd = nextBlock(job, blockStart, blockDepth, limit);
+        int rows = chainRadius(job, blockStart, blockEnd);
+        haloRows = rows > haloRows ? rows : haloRows;
+    }
+
+    // set the responsability of a thread: a band of whole rows
+    int rowLow, rowHigh;
+    computeBand(givenImage.height, rank, size, &rowLow, &rowHigh);
+
+    // neighbours owning the rows right above and below the band
+    int prevRank = MPI_PROC_NULL;
+    int nextRank = MPI_PROC_NULL;
+    if (rowLow < rowHigh) {
+        if (rank > 0) {
+            prevRank = rank - 1;
+        }
+        if (rank + 1 < size && rowHigh < givenImage.height) {
+            nextRank = rank + 1;
+        }
+    }
+
+    // compressed outputs deflate the band in stripes
+    bandEncoder enc;
+    if (format != FORMAT_PNM) {
+        startEncoder(&enc, &givenImage, rowLow, rowHigh, format,
+            opts->compression, pool->active, comm);
+    }
+
+    // read only the band and the ghost rows the first block needs
+    int storeLow = rowLow - haloRows > 0 ? rowLow - haloRows : 0;
+    int storeHigh = rowHigh + haloRows < givenImage.height ?
+        rowHigh + haloRows : givenImage.height;
+    if (rowLow == rowHigh) {
+        storeLow = storeHigh = rowLow;
+    }
+    begin = profileBegin();
+    readBand(job->input, &givenImage, dataOffset, storeLow,
+        storeHigh - storeLow, opts->io, comm);
+    profilePhase(PHASE_READ, begin,
+        (long)(storeHigh - storeLow) * fileRowBytes(&givenImage));
+
+    // a second buffer with the same rows: every pass reads one and writes
+    // the other, and the border samples no pass writes are copied once
+    image buffers[2];
+    stencil st;
+    buffers[0] = givenImage;
+    buffers[1] = givenImage;
+    allocRows(&buffers[1], storeLow, storeHigh - storeLow);
+    passJob copyJob = {&buffers[1], &buffers[0], storeLow, storeHigh, NULL};
+    begin = profileBegin();
+    runPool(pool, copyRowsTask, &copyJob);
+    profilePhase(PHASE_COPY, begin,
+        (long)(storeHigh - storeLow) * givenImage.stride * givenImage.planes);
+    int current = 0;  // the buffer holding the latest pass
+
+    // with an odd block depth the halo lands in either buffer
+    haloRequests halo[2];
+    int overlap = opts->overlap && rowLow < rowHigh;
+    for (int b = 0; b < 2 && overlap; b++) {
+        initHalo(&halo[b], &buffers[b], rowLow, rowHigh, haloRows, prevRank,
+            nextRank, comm);
+    }
+
+    // for each block of filters
+    int blockEnd;
+    for (int blockStart = 0; blockStart < filterCount;
+        blockStart = blockEnd) {
+        blockEnd = nextBlock(job, blockStart, blockDepth, limit);
+
+        if (rowLow == rowHigh) {  // more processes than rows
+            for (int passes = blockStart + 1; opts->prefixes != NULL &&
+                passes <= blockEnd && passes < filterCount; passes++) {
+                storePrefix(opts->prefixes, passes, &buffers[current], rowLow,
+                    rowHigh, opts->io, comm);
+            }
+            continue;
+        }
+
+        // refresh the ghost rows written by the previous block
+        if (blockStart > 0 && overlap) {  // started by the last block
+            begin = profileBegin();
+            MPI_Waitall(halo[current].count, halo[current].requests,
+                MPI_STATUSES_IGNORE);
+            profilePhase(PHASE_WAIT, begin, 0);
+        } else if (blockStart > 0) {
+            exchangeHalo(&buffers[current], rowLow, rowHigh,
+                chainRadius(job, blockStart, blockEnd), prevRank, nextRank,
+                comm);
+        }
+
+        // for each filter
+        for (int filterIndex = blockStart; filterIndex < blockEnd; filterIndex++) {
+            prepareFilter(&st, job->chain[filterIndex]);
+
+            // the later filters of the block still read this many ghost
+            // rows, so recompute them here instead of asking for them; each
+            // pass only reads rows the one before it wrote
+            int margin = chainRadius(job, filterIndex + 1, blockEnd);
+            int computeLow = prevRank != MPI_PROC_NULL ? rowLow - margin : rowLow;
+            int computeHigh = nextRank != MPI_PROC_NULL ? rowHigh + margin : rowHigh;
+
+            // apply the filter into the other buffer
+            passJob filterJob = {&buffers[1 - current], &buffers[current],
+                computeLow, computeHigh, &st, job->chain[filterIndex]->conv};
+            begin = profileBegin();
+            if (overlap && filterIndex == blockEnd - 1 && blockEnd < filterCount) {
+                filterAndSend(&filterJob, haloRows, &halo[1 - current], pool);
+            } else if (format != FORMAT_PNM && filterIndex == filterCount - 1) {
+                encodePassJob fused = {&filterJob, &enc};
+                runPool(pool, filterEncodeTask, &fused);
+            } else {
+                runPool(pool, applyFilterTask, &filterJob);
+            }
+            profileFilter(job->chain[filterIndex], begin,
+                (long)(computeHigh - computeLow) * givenImage.rowSamples *
+                givenImage.planes);
+            current = 1 - current;
+
+            // every pass leaves the whole band done, whatever the margin, so
+            // the cache can resume a later job from it
+            if (opts->prefixes != NULL && filterIndex + 1 < filterCount) {
+                storePrefix(opts->prefixes, filterIndex + 1,
+                    &buffers[current], rowLow, rowHigh, opts->io, comm);
+            }
+        }
+    }
+    for (int b = 0; b < 2 && overlap; b++) {
+        freeHalo(&halo[b]);
+    }
+
+    // write the output data, every band at its own offset
+    if (format != FORMAT_PNM) {
+        if (filterCount == 0) {  // no last pass to deflate along
+            enc.source = &buffers[current];
+            runPool(pool, encodeTask, &enc);
+        }
+        writeEncoded(job->output, &enc, comm);
+    } else {
+        begin = profileBegin();
+        writeBands(job->output, &buffers[current], rowLow, rowHigh, opts->io,
+            comm);
+        profilePhase(PHASE_WRITE, begin,
+            (long)(rowHigh - rowLow) * fileRowBytes(&givenImage));
+    }
+
+    // clear up image data
+    freeImage(&buffers[0]);
+    freeImage(&buffers[1]);
+}
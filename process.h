@@ -0,0 +1,113 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <mpi.h>
+
+#include "image.h"
+#include "filters.h"
+#include "pool.h"
+
+#define AUTO_BLOCK 0
+#define AUTO_THREADS 0
+#define MAX_BLOCK_DEPTH 16
+#define MAX_REDUNDANT_PERCENT 5
+#define MAX_PIPELINE_GROUPS 64
+
+#define HALO_TAG 1
+
+// the configurations an autotune run found, see tune.h
+typedef struct tuning tuning;
+// where the passes of a cached job go, see cache.h
+typedef struct cachePrefixes cachePrefixes;
+
+typedef struct {
+    int blockDepth;  // filters per halo exchange, AUTO_BLOCK to pick one
+    int layout;  // INTERLEAVED or PLANAR color samples
+    int isa;  // row kernels to use, ISA_AUTO to ask the cpu
+    int threads;  // workers per process, AUTO_THREADS for one per cpu
+    int pin;  // pin every worker to its own cpu
+    int io;  // IO_POSIX, IO_MPI, IO_MMAP or IO_FUNNEL
+    long splitSize;  // batch images of at least this many bytes are split
+    int stripeRows;  // rows per stripe when streaming, NO_STREAM for bands
+    int tiles;  // split in 2D tiles instead of bands of rows
+    int stealRows;  // rows per stolen chunk, NO_STEAL for fixed bands
+    int shared;  // the ranks of a node share one copy of the image
+    int pipelineGroups;  // groups of a stage pipeline, NO_PIPELINE for none
+    int groupRanks[MAX_PIPELINE_GROUPS];  // ranks of every pipeline group
+    int overlap;  // send the halo while the band interior is filtered
+    int convolution;  // path of the kernel files, CONV_AUTO to pick one
+    const char *socketPath;  // serve jobs sent to this socket, NULL for none
+    const char *tuneFile;  // autotune the jobs into this file, NULL for none
+    const char *tuningFile;  // tuning loaded at startup, NULL for none
+    const tuning *tuned;  // loaded from tuningFile, NULL for none
+    int fixed;  // FIXED_* settings given on the command line
+    const char *cacheDir;  // prefix result cache, NULL for none
+    long cacheSize;  // bytes the cache entries may take
+    const cachePrefixes *prefixes;  // cache every block end, NULL for none
+    int compression;  // zlib level of .png and .gz outputs
+    const char *report;  // JSON timing report, NULL for none
+    const char *trace;  // Chrome trace of every phase, NULL for none
+}options;
+
+// one image to filter: input, output and the filters in order
+typedef struct {
+    const char *input;
+    const char *output;
+    const filterDef **chain;
+    int filterCount;
+}imageJob;
+
+// one step of a filter pass, split over the threads of a process
+typedef struct {
+    image *dst;
+    image *src;
+    int rowLow;
+    int rowHigh;
+    const stencil *st;
+    const convolution *conv;  // a kernel file pass instead of st
+}passJob;
+
+// compute the [rowLow, rowHigh) band of rows owned by a process
+void computeBand(int height, int rank, int size, int *rowLow, int *rowHigh);
+
+// apply a 3x3 filter on the rows [rowLow, rowHigh) of every plane
+void applyFilter(image *dst, image *src, int rowLow, int rowHigh,
+    const stencil *st);
+
+// copy the job rows of every plane from src to dst, one share per thread
+void copyRowsTask(void *arg, int thread, int threads);
+// copy the samples of the job rows no filter writes
+void copyBordersTask(void *arg, int thread, int threads);
+// filter the job rows, one share per thread
+void applyFilterTask(void *arg, int thread, int threads);
+
+// swap the depth edge rows of a band with the neighbour bands
+void exchangeHalo(image *img, int rowLow, int rowHigh, int depth,
+    int prevRank, int nextRank, MPI_Comm comm);
+
+// pick how many filters run between two halo exchanges
+int chooseBlockDepth(int requested, int filterCount, int height, int size);
+
+// the deepest halo a band can give its neighbours, the rows of the
+// thinnest band
+int haloLimit(int height, int size);
+
+// rows the filters [first, last) of a chain read past a band together
+int chainRadius(const imageJob *job, int first, int last);
+
+// the largest radius of a filter of job
+int widestRadius(const imageJob *job);
+
+// the most ranks, at most size, that can cut length rows in bands which
+// each hold the widest radius of job; the ranks past them sit the image out
+int radiusRanks(const imageJob *job, int length, int size);
+
+// the end of the block starting at blockStart: at most depth filters whose
+// radii add up to at most limit rows, and at least one
+int nextBlock(const imageJob *job, int blockStart, int depth, int limit);
+
+// filter one image with every rank of comm, each owning a band of rows
+void processImage(const imageJob *job, const options *opts, threadPool *pool,
+    MPI_Comm comm);
+
+#endif
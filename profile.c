@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+// a slot per phase, then one per filter of the table
+#define SLOTS (PHASE_COUNT + MAX_PROFILED_FILTERS)
+// the wall time, then the seconds, bytes and calls of every slot
+#define VALUES (1 + 3 * SLOTS)
+#define TRACE_CHUNK 4096  // events the trace grows by
+
+// one timed section, relative to the start of the run
+typedef struct {
+    double start;
+    double duration;
+    int slot;
+}traceEvent;
+
+int profiling = 0;
+
+static const char *phaseNames[PHASE_COUNT] = {
+    "header", "read", "copy", "filter", "halo", "wait", "write", "schedule",
+    "encode"
+};
+
+static int tracing;
+static double startTime;
+static double seconds[SLOTS];
+static double bytes[SLOTS];
+static double calls[SLOTS];
+static traceEvent *events;
+static int eventCount;
+static int eventCapacity;
+
+void startProfile(int trace, MPI_Comm comm) {
+    MPI_Barrier(comm);
+    profiling = 1;
+    tracing = trace;
+    startTime = MPI_Wtime();
+}
+
+static const char *slotName(int slot) {
+    if (slot < PHASE_COUNT) {
+        return phaseNames[slot];
+    }
+    return filterById(slot - PHASE_COUNT)->name;
+}
+
+static void record(int slot, double begin, double end, long moved,
+    int traced) {
+    seconds[slot] += end - begin;
+    bytes[slot] += moved;
+    calls[slot]++;
+
+    if (!tracing || !traced) {
+        return;
+    }
+    if (eventCount == eventCapacity) {
+        eventCapacity += TRACE_CHUNK;
+        events = (traceEvent *)realloc(events,
+            eventCapacity * sizeof(traceEvent));
+        if (events == NULL) {
+            perror("error growing the trace");
+            exit(1);
+        }
+    }
+    events[eventCount].start = begin - startTime;
+    events[eventCount].duration = end - begin;
+    events[eventCount].slot = slot;
+    eventCount++;
+}
+
+void recordPhase(int phase, double begin, long moved) {
+    record(phase, begin, MPI_Wtime(), moved, 1);
+}
+
+void recordFilter(const filterDef *def, double begin, long moved) {
+    double end = MPI_Wtime();
+    int id = filterId(def);
+
+    // the trace shows the filter, the phase only adds up
+    record(PHASE_FILTER, begin, end, moved, id >= MAX_PROFILED_FILTERS);
+    if (id < MAX_PROFILED_FILTERS) {
+        record(PHASE_COUNT + id, begin, end, moved, 1);
+    }
+}
+
+// "name": {min, max, mean, max / mean} of a value over size ranks
+static void writeStats(FILE *file, const char *name, const char *format,
+    double minimum, double maximum, double total, int size) {
+    double mean = total / size;
+    // no work at all is as balanced as it gets
+    double imbalance = mean > 0 ? maximum / mean : 1;
+
+    fprintf(file, "\"%s\": {\"min\": ", name);
+    fprintf(file, format, minimum);
+    fprintf(file, ", \"max\": ");
+    fprintf(file, format, maximum);
+    fprintf(file, ", \"mean\": ");
+    fprintf(file, format, mean);
+    fprintf(file, ", \"imbalance\": %.3f}", imbalance);
+}
+
+static void writeSlot(FILE *file, int slot, const double *minimum,
+    const double *maximum, const double *total, int size) {
+    const double *low = minimum + 1;
+    const double *high = maximum + 1;
+    const double *sum = total + 1;
+
+    fprintf(file, "    \"%s\": {", slotName(slot));
+    writeStats(file, "seconds", "%.6f", low[slot], high[slot], sum[slot],
+        size);
+    fprintf(file, ", ");
+    writeStats(file, "bytes", "%.0f", low[SLOTS + slot], high[SLOTS + slot],
+        sum[SLOTS + slot], size);
+    fprintf(file, ", \"calls\": %.0f}", sum[2 * SLOTS + slot]);
+}
+
+static void writeReport(const char *fileName, const double *minimum,
+    const double *maximum, const double *total, int size, MPI_Comm comm) {
+    FILE *file = fopen(fileName, "w");
+    if (file == NULL) {
+        perror("error opening profile report");
+        MPI_Abort(comm, 1);
+    }
+
+    fprintf(file, "{\n  \"ranks\": %d,\n  ", size);
+    writeStats(file, "wall", "%.6f", minimum[0], maximum[0], total[0], size);
+    fprintf(file, ",\n  \"phases\": {\n");
+    for (int slot = 0; slot < PHASE_COUNT; slot++) {
+        writeSlot(file, slot, minimum, maximum, total, size);
+        fprintf(file, slot + 1 < PHASE_COUNT ? ",\n" : "\n");
+    }
+
+    // only the filters some rank ran
+    fprintf(file, "  },\n  \"filters\": {");
+    const char *separator = "\n";
+    for (int id = 0; id < MAX_PROFILED_FILTERS && filterById(id) != NULL;
+        id++) {
+        int slot = PHASE_COUNT + id;
+        if (total[1 + 2 * SLOTS + slot] == 0) {
+            continue;
+        }
+        fprintf(file, "%s", separator);
+        writeSlot(file, slot, minimum, maximum, total, size);
+        separator = ",\n";
+    }
+    fprintf(file, "\n  }\n}\n");
+
+    if (fclose(file) != 0) {
+        perror("error writing profile report");
+        MPI_Abort(comm, 1);
+    }
+}
+
+// gather every event on rank 0 and write them in the Chrome trace event
+// format, one process per rank
+static void writeTrace(const char *fileName, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int eventBytes = eventCount * (int)sizeof(traceEvent);
+    int *counts = NULL;
+    int *displacements = NULL;
+    traceEvent *allEvents = NULL;
+    if (rank == 0) {
+        counts = (int *)malloc(size * sizeof(int));
+        displacements = (int *)malloc(size * sizeof(int));
+    }
+    MPI_Gather(&eventBytes, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+    if (rank == 0) {
+        int totalBytes = 0;
+        for (int i = 0; i < size; i++) {
+            displacements[i] = totalBytes;
+            totalBytes += counts[i];
+        }
+        allEvents = (traceEvent *)malloc(totalBytes > 0 ? totalBytes : 1);
+    }
+    MPI_Gatherv(events != NULL ? (void *)events : (void *)&eventBytes,
+        eventBytes, MPI_BYTE, allEvents, counts, displacements, MPI_BYTE, 0,
+        comm);
+    if (rank != 0) {
+        return;
+    }
+
+    FILE *file = fopen(fileName, "w");
+    if (file == NULL) {
+        perror("error opening trace");
+        MPI_Abort(comm, 1);
+    }
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (int i = 0; i < size; i++) {
+        fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", "
+            "\"pid\": %d, \"args\": {\"name\": \"rank %d\"}},\n", i, i);
+    }
+    const char *separator = "";
+    for (int i = 0; i < size; i++) {
+        const traceEvent *rankEvents = allEvents + displacements[i] /
+            sizeof(traceEvent);
+        int count = counts[i] / (int)sizeof(traceEvent);
+
+        for (int e = 0; e < count; e++) {
+            int slot = rankEvents[e].slot;
+            fprintf(file, "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", "
+                "\"pid\": %d, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f}",
+                separator, slotName(slot),
+                slot < PHASE_COUNT ? "phase" : "filter", i,
+                rankEvents[e].start * 1e6, rankEvents[e].duration * 1e6);
+            separator = ",\n";
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    if (fclose(file) != 0) {
+        perror("error writing trace");
+        MPI_Abort(comm, 1);
+    }
+    free(counts);
+    free(displacements);
+    free(allEvents);
+}
+
+void writeProfile(const char *reportName, const char *traceName,
+    MPI_Comm comm) {
+    if (!profiling) {
+        return;
+    }
+    profiling = 0;
+
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    double local[VALUES];
+    double minimum[VALUES];
+    double maximum[VALUES];
+    double total[VALUES];
+    local[0] = MPI_Wtime() - startTime;
+    memcpy(local + 1, seconds, sizeof(seconds));
+    memcpy(local + 1 + SLOTS, bytes, sizeof(bytes));
+    memcpy(local + 1 + 2 * SLOTS, calls, sizeof(calls));
+    MPI_Reduce(local, minimum, VALUES, MPI_DOUBLE, MPI_MIN, 0, comm);
+    MPI_Reduce(local, maximum, VALUES, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(local, total, VALUES, MPI_DOUBLE, MPI_SUM, 0, comm);
+
+    if (rank == 0 && reportName != NULL) {
+        writeReport(reportName, minimum, maximum, total, size, comm);
+    }
+    if (traceName != NULL) {
+        writeTrace(traceName, comm);
+    }
+    free(events);
+    events = NULL;
+    eventCount = eventCapacity = 0;
+}
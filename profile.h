@@ -0,0 +1,58 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <mpi.h>
+
+#include "filters.h"
+
+// phases a rank spends its time in
+#define PHASE_HEADER 0  // parsing and sharing the header
+#define PHASE_READ 1  // reading rows
+#define PHASE_COPY 2  // filling the second buffer
+#define PHASE_FILTER 3  // filter passes, every filter together
+#define PHASE_HALO 4  // blocking halo exchanges
+#define PHASE_WAIT 5  // waiting for overlapped halo messages
+#define PHASE_WRITE 6  // writing rows
+#define PHASE_SCHEDULE 7  // batch workers waiting for a job
+#define PHASE_ENCODE 8  // deflating compressed output, the slowest thread
+#define PHASE_COUNT 9
+
+#define MAX_PROFILED_FILTERS 16
+
+// set once by startProfile, every timer is a no-op while it is 0
+extern int profiling;
+
+// start timing on every rank of comm, after a barrier so the trace
+// timelines line up; trace keeps every event for a Chrome trace
+void startProfile(int trace, MPI_Comm comm);
+
+// the start of a timed section, 0 when not profiling
+static inline double profileBegin(void) {
+    return profiling ? MPI_Wtime() : 0;
+}
+
+// close a section started at begin, moving bytes
+void recordPhase(int phase, double begin, long bytes);
+static inline void profilePhase(int phase, double begin, long bytes) {
+    if (profiling) {
+        recordPhase(phase, begin, bytes);
+    }
+}
+
+// close a filter pass started at begin over bytes of samples, counted in
+// PHASE_FILTER as well
+void recordFilter(const filterDef *def, double begin, long bytes);
+static inline void profileFilter(const filterDef *def, double begin,
+    long bytes) {
+    if (profiling) {
+        recordFilter(def, begin, bytes);
+    }
+}
+
+// reduce the timers of every rank of comm into a JSON report with min,
+// max, mean and max / mean for every phase and filter, and gather the
+// events into a Chrome trace; either file name may be NULL
+void writeProfile(const char *reportName, const char *traceName,
+    MPI_Comm comm);
+
+#endif
@@ -0,0 +1,275 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "batch.h"
+#include "encode.h"
+#include "filters.h"
+#include "pnm.h"
+
+// the longest reason a job is refused for, and a reply carrying it whole
+#define REASON_MAX (CONV_ERROR_MAX > PNM_ERROR_MAX ? \
+    CONV_ERROR_MAX : PNM_ERROR_MAX)
+#define ERROR_PREFIX "error "
+#define REPLY_MAX (REASON_MAX + sizeof(ERROR_PREFIX))
+#define LINE_SEPARATORS " \t\r\n"
+
+// the latency of every job served, in seconds
+typedef struct {
+    double *seconds;
+    int count;
+    int capacity;
+}latencyLog;
+
+static void logLatency(latencyLog *log, double seconds) {
+    if (log->count == log->capacity) {
+        log->capacity = log->capacity > 0 ? 2 * log->capacity : 1024;
+        log->seconds = (double *)realloc(log->seconds,
+            log->capacity * sizeof(double));
+    }
+    log->seconds[log->count++] = seconds;
+}
+
+static int compareSeconds(const void *a, const void *b) {
+    double first = *(const double *)a;
+    double second = *(const double *)b;
+
+    return (first > second) - (first < second);
+}
+
+// the nearest rank percentile of sorted latencies
+static double percentile(const double *sorted, int count, int percent) {
+    int index = (count * percent + 99) / 100 - 1;
+
+    return count > 0 ? sorted[index > 0 ? index : 0] : 0;
+}
+
+static void formatLatencies(const latencyLog *log, char *text, size_t size) {
+    double *sorted = (double *)malloc((log->count > 0 ? log->count : 1) *
+        sizeof(double));
+
+    memcpy(sorted, log->seconds, log->count * sizeof(double));
+    qsort(sorted, log->count, sizeof(double), compareSeconds);
+    snprintf(text, size, "%d requests, p50 %.3f ms, p99 %.3f ms, max %.3f ms",
+        log->count, 1000 * percentile(sorted, log->count, 50),
+        1000 * percentile(sorted, log->count, 99),
+        1000 * percentile(sorted, log->count, 100));
+    free(sorted);
+}
+
+// whether fileName is a whole image the filters take, its shape in shape
+static int checkInput(const char *fileName, image *shape, char *reason,
+    size_t size) {
+    struct stat info;
+    int fd = open(fileName, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        snprintf(reason, size, "cannot read %s", fileName);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+    // only the header pages are touched
+    void *bytes = info.st_size > 0 ? mmap(NULL, info.st_size, PROT_READ,
+        MAP_SHARED, fd, 0) : NULL;
+    close(fd);
+    if (bytes == MAP_FAILED) {
+        snprintf(reason, size, "cannot read %s", fileName);
+        return 0;
+    }
+    int valid = scanHeader((const unsigned char *)bytes, info.st_size, shape,
+        INTERLEAVED, reason, size) >= 0 && checkSamples(shape, reason, size);
+    if (bytes != NULL) {
+        munmap(bytes, info.st_size);
+    }
+    return valid;
+}
+
+// whether the output of an image shaped like shape can be written
+static int checkOutput(const char *fileName, const image *shape,
+    char *reason, size_t size) {
+    int fd = open(fileName, O_WRONLY | O_CREAT, 0644);
+
+    if (fd < 0) {
+        snprintf(reason, size, "cannot write %s: %s", fileName,
+            strerror(errno));
+        return 0;
+    }
+    close(fd);
+    if (outputFormat(fileName) == FORMAT_PNG &&
+        shape->maxval != PNM_MAXVAL_8BIT) {
+        snprintf(reason, size, "PNG output needs a maxval of %d, not %d",
+            PNM_MAXVAL_8BIT, shape->maxval);
+        return 0;
+    }
+    return 1;
+}
+
+// why a job line would fail instead of running, NULL if it runs. The ranks
+// exit on a bad image or kernel file, which would take the server down,
+// so rank 0 checks all of it before sharing the line: the input header
+// and payload size, the kernel files and the output; kernels wider than a
+// band are run on fewer ranks
+static const char *checkLine(const char *line, char *reason, size_t size) {
+    char *copy = strdup(line);
+    const char *fields[2] = {NULL, NULL};
+    image shape;
+    int tokens = 0;
+
+    reason[0] = '\0';
+    char *token = strtok(copy, LINE_SEPARATORS);
+    for (; token != NULL && reason[0] == '\0';
+        token = strtok(NULL, LINE_SEPARATORS)) {
+        if (tokens < 2) {
+            fields[tokens] = token;
+        }
+        if (tokens == 0) {
+            checkInput(token, &shape, reason, size);
+        } else if (tokens >= 2) {
+            lookupFilter(token, reason, size);
+        }
+        tokens++;
+    }
+    if (reason[0] == '\0' && tokens < 2) {
+        snprintf(reason, size, "expected input output [filters...]");
+    }
+    if (reason[0] == '\0') {
+        checkOutput(fields[1], &shape, reason, size);
+    }
+    free(copy);
+    return reason[0] != '\0' ? reason : NULL;
+}
+
+static int openSocket(const char *socketPath, MPI_Comm comm) {
+    struct sockaddr_un address;
+
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", socketPath);
+        MPI_Abort(comm, 1);
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+
+    // left behind by a server that did not stop
+    unlink(socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0
+        || listen(fd, SERVER_BACKLOG) != 0) {
+        perror("error opening server socket");
+        MPI_Abort(comm, 1);
+    }
+    return fd;
+}
+
+// a client that went away only loses its answer
+static void sendReply(int client, const char *reply) {
+    char line[REPLY_MAX + 1];
+    size_t length = strlen(reply) < REPLY_MAX ? strlen(reply) : REPLY_MAX - 1;
+
+    memcpy(line, reply, length);
+    line[length++] = '\n';
+    send(client, line, length, MSG_NOSIGNAL);
+}
+
+// one job on every rank, answered once every rank has written its rows
+static void runJob(const char *line, const options *opts, threadPool *pool,
+    MPI_Comm comm) {
+    char *shared = shareLine(line, comm);
+
+    runLine(shared, opts, pool, comm);
+    MPI_Barrier(comm);
+    free(shared);
+}
+
+// rank 0: answer the clients one at a time, every line of a connection in
+// turn, until one asks to stop
+static void serveClients(int listener, const options *opts, threadPool *pool,
+    MPI_Comm comm) {
+    latencyLog log = {NULL, 0, 0};
+    char reply[REPLY_MAX];
+    char reason[REASON_MAX];
+    int stopping = 0;
+
+    while (!stopping) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0 && errno == EINTR) {
+            continue;
+        }
+        if (client < 0) {
+            perror("error accepting client");
+            break;
+        }
+
+        FILE *requests = fdopen(client, "r");
+        char *line = NULL;
+        size_t length = 0;
+        while (!stopping && getline(&line, &length, requests) != -1) {
+            line[strcspn(line, "\r\n")] = '\0';
+            double start = MPI_Wtime();
+            if (strcmp(line, STOP_REQUEST) == 0) {
+                stopping = 1;
+                formatLatencies(&log, reply, sizeof(reply));
+            } else if (strcmp(line, STATS_REQUEST) == 0) {
+                formatLatencies(&log, reply, sizeof(reply));
+            } else if (checkLine(line, reason, sizeof(reason)) != NULL) {
+                snprintf(reply, sizeof(reply), ERROR_PREFIX "%s", reason);
+            } else {
+                runJob(line, opts, pool, comm);
+                double seconds = MPI_Wtime() - start;
+                logLatency(&log, seconds);
+                snprintf(reply, sizeof(reply), "ok %.6f", seconds);
+            }
+            sendReply(client, reply);
+            // the next job reads its kernel files again, edited or not
+            releaseKernelFiles();
+        }
+        free(line);
+        fclose(requests);
+    }
+
+    // an empty line stops the other ranks
+    free(shareLine("", comm));
+    formatLatencies(&log, reply, sizeof(reply));
+    printf("served %s\n", reply);
+    free(log.seconds);
+}
+
+void runServer(const char *socketPath, const options *opts, threadPool *pool,
+    MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    // the buffers a request frees stay in the heap for the next one
+    mallopt(M_MMAP_THRESHOLD, SERVER_MMAP_THRESHOLD);
+    mallopt(M_TRIM_THRESHOLD, 2 * SERVER_MMAP_THRESHOLD);
+
+    if (rank == 0) {
+        int listener = openSocket(socketPath, comm);
+        serveClients(listener, opts, pool, comm);
+        close(listener);
+        unlink(socketPath);
+        return;
+    }
+    for (;;) {
+        char *line = shareLine(NULL, comm);
+        if (line[0] == '\0') {
+            free(line);
+            return;
+        }
+        runLine(line, opts, pool, comm);
+        MPI_Barrier(comm);
+        releaseKernelFiles();
+        free(line);
+    }
+}
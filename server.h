@@ -0,0 +1,25 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <mpi.h>
+
+#include "process.h"
+
+#define SERVER_BACKLOG 16
+// freed image buffers stay in the heap up to this size, so the next request
+// reuses warm pages instead of mapping new ones
+#define SERVER_MMAP_THRESHOLD (32 << 20)
+
+// the requests a client sends, one per line
+#define STATS_REQUEST "stats"
+#define STOP_REQUEST "stop"
+
+// keep the MPI job up and filter the "input output [filters...]" lines
+// clients send to a Unix socket at socketPath: rank 0 accepts them, shares
+// every job with the other ranks and answers "ok seconds" or "error why"
+// once the output is written. "stats" answers the request count and the
+// p50, p99 and max latency, "stop" ends the server, which prints the same
+void runServer(const char *socketPath, const options *opts, threadPool *pool,
+    MPI_Comm comm);
+
+#endif
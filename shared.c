@@ -0,0 +1,226 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "shared.h"
+#include "bandio.h"
+#include "pnm.h"
+#include "profile.h"
+
+// the ranks of a node and the window they share
+typedef struct {
+    MPI_Comm nodeComm;  // the ranks of this node
+    MPI_Comm leaderComm;  // rank 0 of every node, MPI_COMM_NULL elsewhere
+    MPI_Win window;
+    int nodeRank;
+    int nodeSize;
+    int nodeIndex;  // rank of the node leader among the leaders
+    int nodeCount;
+}nodeGroup;
+
+static void splitNodes(nodeGroup *group, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
+        &group->nodeComm);
+    MPI_Comm_rank(group->nodeComm, &group->nodeRank);
+    MPI_Comm_size(group->nodeComm, &group->nodeSize);
+    MPI_Comm_split(comm, group->nodeRank == 0 ? 0 : MPI_UNDEFINED, rank,
+        &group->leaderComm);
+
+    int place[2];
+    if (group->nodeRank == 0) {
+        MPI_Comm_rank(group->leaderComm, &place[0]);
+        MPI_Comm_size(group->leaderComm, &place[1]);
+    }
+    MPI_Bcast(place, 2, MPI_INT, 0, group->nodeComm);
+    group->nodeIndex = place[0];
+    group->nodeCount = place[1];
+}
+
+// every store of the node is seen by all its ranks past this point
+static void syncNode(nodeGroup *group) {
+    double begin = profileBegin();
+
+    MPI_Win_sync(group->window);
+    MPI_Barrier(group->nodeComm);
+    MPI_Win_sync(group->window);
+    profilePhase(PHASE_WAIT, begin, 0);
+}
+
+void sharedImage(const imageJob *job, const options *opts, threadPool *pool,
+    MPI_Comm comm) {
+    nodeGroup group;
+    splitNodes(&group, comm);
+
+    image shape;
+    double begin = profileBegin();
+    long dataOffset = shareHeader(job->input, &shape, opts->layout, comm);
+    profilePhase(PHASE_HEADER, begin, dataOffset);
+    int height = shape.height;
+    int filterCount = job->filterCount;
+    size_t rowBytes = fileRowBytes(&shape);
+
+    // a kernel reaching past the thinnest node band makes for fewer nodes
+    int nodes = radiusRanks(job, height, group.nodeCount);
+    if (nodes < group.nodeCount) {
+        int rank;
+        MPI_Comm active;
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_split(comm, group.nodeIndex < nodes ? 0 : MPI_UNDEFINED, rank,
+            &active);
+        if (group.leaderComm != MPI_COMM_NULL) {
+            MPI_Comm_free(&group.leaderComm);
+        }
+        MPI_Comm_free(&group.nodeComm);
+        if (active != MPI_COMM_NULL) {
+            sharedImage(job, opts, pool, active);
+            MPI_Comm_free(&active);
+        }
+        return;
+    }
+
+    // the nodes split the image in bands like ranks do, and swap halos as
+    // deep as a block of filters
+    int blockDepth = chooseBlockDepth(opts->blockDepth, filterCount, height,
+        group.nodeCount);
+    int limit = haloLimit(height, group.nodeCount);
+    int haloRows = 0;
+    for (int blockStart = 0, blockEnd; blockStart < filterCount;
+        blockStart = blockEnd) {
+        blockEnd = nextBlock(job, blockStart, blockDepth, limit);
+        int rows = chainRadius(job, blockStart, blockEnd);
+        haloRows = rows > haloRows ? rows : haloRows;
+    }
+
+    int nodeLow, nodeHigh;
+    computeBand(height, group.nodeIndex, group.nodeCount, &nodeLow, &nodeHigh);
+    int prevNode = MPI_PROC_NULL;
+    int nextNode = MPI_PROC_NULL;
+    if (nodeLow < nodeHigh) {
+        if (group.nodeIndex > 0) {
+            prevNode = group.nodeIndex - 1;
+        }
+        if (group.nodeIndex + 1 < group.nodeCount && nodeHigh < height) {
+            nextNode = group.nodeIndex + 1;
+        }
+    }
+    int storeLow = nodeLow - haloRows > 0 ? nodeLow - haloRows : 0;
+    int storeHigh = nodeHigh + haloRows < height ? nodeHigh + haloRows : height;
+    if (nodeLow == nodeHigh) {
+        storeLow = storeHigh = nodeLow;
+    }
+
+    // one window on the node leader holds both buffers, the other ranks of
+    // the node map it
+    image buffers[2];
+    buffers[0] = shape;
+    buffers[0].firstRow = storeLow;
+    buffers[0].rows = storeHigh - storeLow;
+    buffers[0].planeSize = shape.stride * buffers[0].rows;
+    size_t bufferSize = buffers[0].planeSize * shape.planes;
+    unsigned char *base;
+    MPI_Aint windowSize = group.nodeRank == 0 ?
+        (MPI_Aint)(2 * bufferSize + IMAGE_ALIGNMENT) : 0;
+    MPI_Win_allocate_shared(windowSize, 1, MPI_INFO_NULL, group.nodeComm,
+        &base, &group.window);
+    int dispUnit;
+    MPI_Win_shared_query(group.window, 0, &windowSize, &dispUnit, &base);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, group.window);
+    buffers[0].data = base + (IMAGE_ALIGNMENT - (size_t)base % IMAGE_ALIGNMENT)
+        % IMAGE_ALIGNMENT;
+    buffers[1] = buffers[0];
+    buffers[1].data = buffers[0].data + bufferSize;
+
+    // every rank reads and copies its share of the node rows
+    int first, last;
+    splitRange(storeLow, storeHigh, group.nodeRank, group.nodeSize, &first,
+        &last);
+    if (first < last) {
+        mappedFile input;
+        begin = profileBegin();
+        mapFile(job->input, dataOffset + first * rowBytes,
+            (last - first) * rowBytes, 0, &input);
+        loadRows(&buffers[0], first, last - first, input.bytes);
+        unmapFile(&input);
+        profilePhase(PHASE_READ, begin, (long)(last - first) * rowBytes);
+
+        passJob copyJob = {&buffers[1], &buffers[0], first, last, NULL};
+        begin = profileBegin();
+        runPool(pool, copyRowsTask, &copyJob);
+        profilePhase(PHASE_COPY, begin,
+            (long)(last - first) * shape.stride * shape.planes);
+    }
+    syncNode(&group);
+    int current = 0;  // the buffer holding the latest pass
+
+    stencil st;
+    int blockEnd;
+    for (int blockStart = 0; blockStart < filterCount;
+        blockStart = blockEnd) {
+        blockEnd = nextBlock(job, blockStart, blockDepth, limit);
+
+        if (nodeLow == nodeHigh) {  // more nodes than rows
+            continue;
+        }
+
+        // only the leaders talk to other nodes
+        if (blockStart > 0) {
+            if (group.nodeRank == 0) {
+                exchangeHalo(&buffers[current], nodeLow, nodeHigh,
+                    chainRadius(job, blockStart, blockEnd), prevNode,
+                    nextNode, group.leaderComm);
+            }
+            syncNode(&group);
+        }
+
+        for (int filterIndex = blockStart; filterIndex < blockEnd;
+            filterIndex++) {
+            prepareFilter(&st, job->chain[filterIndex]);
+
+            // the ghost rows the rest of the block reads are recomputed,
+            // shared out over the node like the band
+            int margin = chainRadius(job, filterIndex + 1, blockEnd);
+            int computeLow = prevNode != MPI_PROC_NULL ?
+                nodeLow - margin : nodeLow;
+            int computeHigh = nextNode != MPI_PROC_NULL ?
+                nodeHigh + margin : nodeHigh;
+            splitRange(computeLow, computeHigh, group.nodeRank,
+                group.nodeSize, &first, &last);
+
+            passJob filterJob = {&buffers[1 - current], &buffers[current],
+                first, last, &st, job->chain[filterIndex]->conv};
+            begin = profileBegin();
+            runPool(pool, applyFilterTask, &filterJob);
+            profileFilter(job->chain[filterIndex], begin,
+                (long)(last - first) * shape.rowSamples * shape.planes);
+            syncNode(&group);
+            current = 1 - current;
+        }
+    }
+
+    // every rank writes its share of the node band in place
+    long headerSize = prepareOutput(job->output, &shape, comm);
+    splitRange(nodeLow, nodeHigh, group.nodeRank, group.nodeSize, &first,
+        &last);
+    if (first < last) {
+        int fd = open(job->output, O_WRONLY);
+        if (fd < 0) {
+            perror("error opening output file");
+            MPI_Abort(comm, 1);
+        }
+        begin = profileBegin();
+        lseek(fd, headerSize + first * rowBytes, SEEK_SET);
+        writeRows(fd, &buffers[current], first, last - first);
+        profilePhase(PHASE_WRITE, begin, (long)(last - first) * rowBytes);
+        close(fd);
+    }
+
+    MPI_Win_unlock_all(group.window);
+    MPI_Win_free(&group.window);
+    if (group.leaderComm != MPI_COMM_NULL) {
+        MPI_Comm_free(&group.leaderComm);
+    }
+    MPI_Comm_free(&group.nodeComm);
+}
@@ -0,0 +1,16 @@
+#ifndef SHARED_H
+#define SHARED_H
+
+#include <mpi.h>
+
+#include "process.h"
+
+// filter one image with every rank of comm, the ranks of a node sharing
+// one pair of buffers in a shared memory window: each node owns a band,
+// its ranks filter their share of it in place and only the node leaders
+// swap ghost rows with the nodes around; gives the same pixels as
+// processImage
+void sharedImage(const imageJob *job, const options *opts, threadPool *pool,
+    MPI_Comm comm);
+
+#endif
@@ -0,0 +1,123 @@
+// the special kernels of every filter, built once per instruction set from
+// this file (see the Makefile); plain C that the compiler vectorizes
+#include "special.h"
+
+// samples summed per column pass, small enough to stay on the stack
+#define CHUNK_SAMPLES 1024
+#define MAX_STEP 3
+
+#define KERNEL_PASTE(name, suffix) name##suffix
+#define KERNEL_CAT(name, suffix) KERNEL_PASTE(name, suffix)
+#define KERNEL_NAME(name) KERNEL_CAT(name, KERNEL_SUFFIX)
+
+// sum the three rows of every column in [first, last), with weights 1 mid 1
+static void sumColumns(unsigned short *column, const unsigned char *above,
+    const unsigned char *row, const unsigned char *below, int first, int last,
+    int mid) {
+    for (int x = first; x < last; x++) {
+        column[x - first] = above[x] + mid * row[x] + below[x];
+    }
+}
+
+// 1 2 1 both ways: every column sum is reused by three outputs; the float
+// sum of k / 16 weights is exact, so the shift matches the truncation
+void KERNEL_NAME(blurRow)(unsigned char *out, const unsigned char *above,
+    const unsigned char *row, const unsigned char *below, int begin, int end,
+    int step, const stencil *st) {
+    unsigned short column[CHUNK_SAMPLES + 2 * MAX_STEP];
+
+    for (int first = begin; first < end; first += CHUNK_SAMPLES) {
+        int last = first + CHUNK_SAMPLES < end ? first + CHUNK_SAMPLES : end;
+        unsigned short *mid = column + step;
+
+        sumColumns(column, above, row, below, first - step, last + step, 2);
+        for (int x = 0; x < last - first; x++) {
+            out[first + x] = (mid[x - step] + 2 * mid[x] + mid[x + step]) >> 4;
+        }
+    }
+}
+
+// box filter from column sums; 1 / 9 is not exact in float, but the float
+// sum stays within 1e-3 of S / 9, so the truncation can only differ from
+// S / 9 when S is a multiple of 9; those pixels take the reference loop
+void KERNEL_NAME(smoothRow)(unsigned char *out, const unsigned char *above,
+    const unsigned char *row, const unsigned char *below, int begin, int end,
+    int step, const stencil *st) {
+    unsigned short column[CHUNK_SAMPLES + 2 * MAX_STEP];
+
+    for (int first = begin; first < end; first += CHUNK_SAMPLES) {
+        int last = first + CHUNK_SAMPLES < end ? first + CHUNK_SAMPLES : end;
+        unsigned short *mid = column + step;
+
+        sumColumns(column, above, row, below, first - step, last + step, 1);
+        for (int x = 0; x < last - first; x++) {
+            int sum = mid[x - step] + mid[x] + mid[x + step];
+            if (sum % 9 != 0) {
+                out[first + x] = sum / 9;
+            } else {
+                filterRowScalar(out, above, row, below, first + x,
+                    first + x + 1, step, st);
+            }
+        }
+    }
+}
+
+// 5-tap cross; the zero taps only add zeros to the float sum, so the same
+// sum over the other five taps, in the same order, rounds the same way
+void KERNEL_NAME(sharpenRow)(unsigned char *out, const unsigned char *above,
+    const unsigned char *row, const unsigned char *below, int begin, int end,
+    int step, const stencil *st) {
+    const float *filter = st->weights;
+
+    for (int x = begin; x < end; x++) {
+        out[x] = (int)(
+            filter[1] * above[x] +
+            filter[3] * row[x - step] +
+            filter[4] * row[x] +
+            filter[5] * row[x + step] +
+            filter[7] * below[x]);
+    }
+}
+
+// 9 x centre minus the 8 neighbours, integer weights so integer math is exact
+void KERNEL_NAME(meanRow)(unsigned char *out, const unsigned char *above,
+    const unsigned char *row, const unsigned char *below, int begin, int end,
+    int step, const stencil *st) {
+    unsigned short column[CHUNK_SAMPLES + 2 * MAX_STEP];
+
+    for (int first = begin; first < end; first += CHUNK_SAMPLES) {
+        int last = first + CHUNK_SAMPLES < end ? first + CHUNK_SAMPLES : end;
+        unsigned short *mid = column + step;
+
+        sumColumns(column, above, row, below, first - step, last + step, 1);
+        for (int x = 0; x < last - first; x++) {
+            out[first + x] = 10 * row[first + x] - (mid[x - step] + mid[x] + mid[x + step]);
+        }
+    }
+}
+
+// only the pixels straight above and below count
+void KERNEL_NAME(embossRow)(unsigned char *out, const unsigned char *above,
+    const unsigned char *row, const unsigned char *below, int begin, int end,
+    int step, const stencil *st) {
+    for (int x = begin; x < end; x++) {
+        out[x] = above[x] - below[x];
+    }
+}
+
+// one tap of a kernel file over count samples, for the convolution engine;
+// integer weights, so the order the taps come in does not matter
+void KERNEL_NAME(accumulateBytes)(int *sums, const unsigned char *samples,
+    int count, int weight) {
+    for (int x = 0; x < count; x++) {
+        sums[x] += weight * samples[x];
+    }
+}
+
+// the same over the column sums of a separable kernel
+void KERNEL_NAME(accumulateInts)(int *sums, const int *samples, int count,
+    int weight) {
+    for (int x = 0; x < count; x++) {
+        sums[x] += weight * samples[x];
+    }
+}
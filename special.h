@@ -0,0 +1,32 @@
+#ifndef SPECIAL_H
+#define SPECIAL_H
+
+#include "kernels.h"
+
+#define DECLARE_SPECIAL_KERNELS(suffix) \
+    void blurRow##suffix(unsigned char *out, const unsigned char *above, \
+        const unsigned char *row, const unsigned char *below, int begin, \
+        int end, int step, const stencil *st); \
+    void smoothRow##suffix(unsigned char *out, const unsigned char *above, \
+        const unsigned char *row, const unsigned char *below, int begin, \
+        int end, int step, const stencil *st); \
+    void sharpenRow##suffix(unsigned char *out, const unsigned char *above, \
+        const unsigned char *row, const unsigned char *below, int begin, \
+        int end, int step, const stencil *st); \
+    void meanRow##suffix(unsigned char *out, const unsigned char *above, \
+        const unsigned char *row, const unsigned char *below, int begin, \
+        int end, int step, const stencil *st); \
+    void embossRow##suffix(unsigned char *out, const unsigned char *above, \
+        const unsigned char *row, const unsigned char *below, int begin, \
+        int end, int step, const stencil *st); \
+    void accumulateBytes##suffix(int *sums, const unsigned char *samples, \
+        int count, int weight); \
+    void accumulateInts##suffix(int *sums, const int *samples, int count, \
+        int weight);
+
+DECLARE_SPECIAL_KERNELS(Scalar)
+DECLARE_SPECIAL_KERNELS(Sse41)
+DECLARE_SPECIAL_KERNELS(Avx2)
+DECLARE_SPECIAL_KERNELS(Avx512)
+
+#endif
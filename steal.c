@@ -0,0 +1,402 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "steal.h"
+#include "bandio.h"
+#include "pnm.h"
+#include "profile.h"
+
+#define EMPTY_QUEUE -1
+// keeps the back end positive when thieves miss on an empty queue
+#define QUEUE_BIAS (1 << 30)
+
+// the state of one image: every rank keeps the chunks it computed in
+// slots of a window, one window per version parity, and the others reach
+// them there through a chunk to slot map
+typedef struct {
+    image shape;
+    MPI_Win slotWindows[2];
+    unsigned char *slots[2];  // the first aligned slot
+    int *paddings[2];  // bytes before the first aligned slot, of every rank
+    size_t slotBytes;  // one chunk of rows in every plane
+    int slotCount;  // chunks a rank can hold, its queue and the slack
+    int used;  // slots filled this pass
+    MPI_Win queueWindow;
+    long *queue;  // chunks [front, back) still to do, see packQueue
+    int *producer;  // rank holding each chunk of the latest version
+    int *slot;  // slot of each chunk at its producer
+    image work;  // the rows a chunk reads, its own and the ghost rows
+    mappedFile input;
+    size_t rowBytes;
+    int chunkRows;
+    int chunkCount;
+    int rank;
+    int size;
+    MPI_Comm comm;
+}stealState;
+
+static long packQueue(int front, int back) {
+    return (long)front << 32 | (long)(back + QUEUE_BIAS);
+}
+
+static int queueFront(long value) {
+    return (int)(value >> 32);
+}
+
+static int queueBack(long value) {
+    return (int)(value & 0xffffffffL) - QUEUE_BIAS;
+}
+
+// set this rank's queue, atomically as the thieves read it
+static void setQueue(stealState *state, int front, int back) {
+    long value = packQueue(front, back);
+    long old;
+
+    MPI_Fetch_and_op(&value, &old, MPI_LONG, state->rank, 0, MPI_REPLACE,
+        state->queueWindow);
+    MPI_Win_flush(state->rank, state->queueWindow);
+}
+
+static long readQueue(stealState *state, int target) {
+    long value;
+
+    MPI_Fetch_and_op(NULL, &value, MPI_LONG, target, 0, MPI_NO_OP,
+        state->queueWindow);
+    MPI_Win_flush(target, state->queueWindow);
+    return value;
+}
+
+// take a chunk off the front or the back of the queue of target with one
+// atomic add, returns EMPTY_QUEUE when there was none left; a claim that
+// misses leaves the ends crossed, which still reads as empty
+static int claimChunk(stealState *state, int target, int fromBack) {
+    long step = fromBack ? -1 : 1L << 32;
+    long old;
+
+    MPI_Fetch_and_op(&step, &old, MPI_LONG, target, 0, MPI_SUM,
+        state->queueWindow);
+    MPI_Win_flush(target, state->queueWindow);
+    if (queueFront(old) >= queueBack(old)) {
+        return EMPTY_QUEUE;
+    }
+    return fromBack ? queueBack(old) - 1 : queueFront(old);
+}
+
+// the next chunk for this rank: its own front, or while it has a free
+// slot the back of the fullest other queue
+static int nextChunk(stealState *state) {
+    int chunk = claimChunk(state, state->rank, 0);
+
+    while (chunk == EMPTY_QUEUE && state->used < state->slotCount) {
+        int victim = -1;
+        int most = 0;
+        for (int i = 1; i < state->size; i++) {
+            int target = (state->rank + i) % state->size;
+            long value = readQueue(state, target);
+            int left = queueBack(value) - queueFront(value);
+            if (left > most) {
+                victim = target;
+                most = left;
+            }
+        }
+        if (victim < 0) {
+            return EMPTY_QUEUE;
+        }
+        chunk = claimChunk(state, victim, 1);
+    }
+    return chunk;
+}
+
+// the rows of chunk in slot index of the window of parity b
+static image slotImage(const stealState *state, int b, int index, int chunk) {
+    image view = state->shape;
+
+    view.firstRow = chunk * state->chunkRows;
+    view.rows = state->chunkRows;
+    view.planeSize = view.stride * state->chunkRows;
+    view.data = state->slots[b] + index * state->slotBytes;
+    return view;
+}
+
+// copy the rows [low, high) of the given version into the work rows, which
+// start at low: rows of the input come from the file, later ones from the
+// slot of the rank that computed them
+static void fetchRows(stealState *state, int version, int low, int high) {
+    int b = version % 2;
+    image *work = &state->work;
+
+    work->firstRow = low;
+    for (int row = low; row < high;) {
+        // a run of rows within one chunk
+        int chunk = row / state->chunkRows;
+        int chunkLow = chunk * state->chunkRows;
+        int end = chunkLow + state->chunkRows < high ?
+            chunkLow + state->chunkRows : high;
+
+        int source = version == 0 ? FROM_FILE : state->producer[chunk];
+        double begin = profileBegin();
+        if (source == FROM_FILE) {
+            loadRows(work, row, end - row,
+                state->input.bytes + row * state->rowBytes);
+            profilePhase(PHASE_READ, begin, (long)(end - row) *
+                state->rowBytes);
+        } else if (source == state->rank) {
+            image held = slotImage(state, b, state->slot[chunk], chunk);
+            passJob copyJob = {work, &held, row, end, NULL};
+            copyRowsTask(&copyJob, 0, 1);
+            profilePhase(PHASE_COPY, begin, (long)(end - row) * work->stride *
+                work->planes);
+        } else {
+            for (int p = 0; p < work->planes; p++) {
+                MPI_Aint offset = state->paddings[b][source] +
+                    state->slot[chunk] * state->slotBytes +
+                    p * state->slotBytes / work->planes +
+                    (row - chunkLow) * work->stride;
+                int count = (int)((end - row) * work->stride);
+                MPI_Get(imageRow(work, p, row), count, MPI_BYTE, source,
+                    offset, count, MPI_BYTE, state->slotWindows[b]);
+            }
+            MPI_Win_flush(source, state->slotWindows[b]);
+            profilePhase(PHASE_HALO, begin, (long)(end - row) * work->stride *
+                work->planes);
+        }
+        row = end;
+    }
+}
+
+// cut the chunks into one contiguous queue per rank, as long as its rate
+// but at most capacity chunks; even queues when no rank measured a rate
+static void splitChunks(const double *measured, int size, int chunkCount,
+    int capacity, int *firsts) {
+    double total = 0;
+    for (int i = 0; i < size; i++) {
+        total += measured[i];
+    }
+    double *rates = (double *)malloc(size * sizeof(double));
+    for (int i = 0; i < size; i++) {
+        rates[i] = total > 0 ? measured[i] : 1;
+    }
+    total = total > 0 ? total : size;
+
+    // whole shares first, then the rest one chunk at a time to the rank
+    // whose queue would still end first
+    int *lengths = (int *)malloc(size * sizeof(int));
+    int assigned = 0;
+    for (int i = 0; i < size; i++) {
+        lengths[i] = (int)(chunkCount * rates[i] / total);
+        lengths[i] = lengths[i] < capacity ? lengths[i] : capacity;
+        assigned += lengths[i];
+    }
+    for (; assigned < chunkCount; assigned++) {
+        int best = -1;
+        for (int i = 0; i < size; i++) {
+            if (lengths[i] < capacity && (best < 0 || (lengths[i] + 1) /
+                rates[i] < (lengths[best] + 1) / rates[best])) {
+                best = i;
+            }
+        }
+        lengths[best]++;
+    }
+
+    firsts[0] = 0;
+    for (int i = 0; i < size; i++) {
+        firsts[i + 1] = firsts[i] + lengths[i];
+    }
+    free(lengths);
+    free(rates);
+}
+
+void stealImage(const imageJob *job, const options *opts, threadPool *pool,
+    MPI_Comm comm) {
+    stealState state;
+    MPI_Comm_rank(comm, &state.rank);
+    MPI_Comm_size(comm, &state.size);
+    state.comm = comm;
+
+    image shape;
+    double begin = profileBegin();
+    long dataOffset = shareHeader(job->input, &shape, opts->layout, comm);
+    profilePhase(PHASE_HEADER, begin, dataOffset);
+    int height = shape.height;
+    int filterCount = job->filterCount;
+    state.shape = shape;
+    state.rowBytes = fileRowBytes(&shape);
+    mapFile(job->input, dataOffset, 0, 0, &state.input);
+
+    // several chunks per rank, so there is something left to steal
+    state.chunkRows = opts->stealRows;
+    if (state.chunkRows == AUTO_CHUNK) {
+        state.chunkRows = height / (state.size * STEAL_CHUNKS_PER_RANK);
+    }
+    state.chunkRows = state.chunkRows > 0 ? state.chunkRows : 1;
+    state.chunkRows = state.chunkRows < height ? state.chunkRows : height;
+    state.chunkCount = (height + state.chunkRows - 1) / state.chunkRows;
+
+    // a rank holds the chunks it computed, a few even shares at most, so
+    // memory stays O(band); rows are padded to IMAGE_ALIGNMENT, and so are
+    // the slots. The window memory comes from MPI, so the others reach it
+    int share = (state.chunkCount + state.size - 1) / state.size;
+    state.slotCount = STEAL_SLACK * share;
+    state.slotBytes = shape.stride * state.chunkRows * shape.planes;
+    for (int b = 0; b < 2; b++) {
+        unsigned char *base;
+        MPI_Win_allocate((MPI_Aint)(state.slotCount * state.slotBytes +
+            IMAGE_ALIGNMENT), 1, MPI_INFO_NULL, comm, &base,
+            &state.slotWindows[b]);
+        int padding = (IMAGE_ALIGNMENT - (size_t)base % IMAGE_ALIGNMENT)
+            % IMAGE_ALIGNMENT;
+        state.slots[b] = base + padding;
+        state.paddings[b] = (int *)malloc(state.size * sizeof(int));
+        MPI_Allgather(&padding, 1, MPI_INT, state.paddings[b], 1, MPI_INT,
+            comm);
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, state.slotWindows[b]);
+    }
+    MPI_Win_allocate(sizeof(long), sizeof(long), MPI_INFO_NULL, comm,
+        &state.queue, &state.queueWindow);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, state.queueWindow);
+    state.producer = (int *)malloc(state.chunkCount * sizeof(int));
+    state.slot = (int *)malloc(state.chunkCount * sizeof(int));
+    int *produced = (int *)malloc(state.chunkCount * sizeof(int));
+    int *filled = (int *)malloc(state.chunkCount * sizeof(int));
+    for (int i = 0; i < state.chunkCount; i++) {
+        state.producer[i] = FROM_FILE;
+    }
+
+    // a chunk and the ghost rows of the widest filter
+    state.work = shape;
+    allocRows(&state.work, 0, state.chunkRows + 2 * widestRadius(job));
+
+    // equal queues for the first pass, then as fast as each rank went
+    double *rates = (double *)malloc(state.size * sizeof(double));
+    int *firsts = (int *)malloc((state.size + 1) * sizeof(int));
+    for (int i = 0; i < state.size; i++) {
+        rates[i] = 1;
+    }
+    splitChunks(rates, state.size, state.chunkCount, state.slotCount, firsts);
+
+    stencil st;
+    for (int pass = 0; pass < filterCount; pass++) {
+        const filterDef *def = job->chain[pass];
+        int radius = filterRadius(def);
+        double busy = 0;
+        int rows = 0;
+
+        prepareFilter(&st, def);
+        setQueue(&state, firsts[state.rank], firsts[state.rank + 1]);
+        state.used = 0;
+        begin = profileBegin();
+        MPI_Barrier(comm);
+        profilePhase(PHASE_WAIT, begin, 0);
+
+        for (int i = 0; i < state.chunkCount; i++) {
+            produced[i] = FROM_FILE;
+            filled[i] = -1;
+        }
+        for (;;) {
+            begin = profileBegin();
+            int chunk = nextChunk(&state);
+            profilePhase(PHASE_SCHEDULE, begin, 0);
+            if (chunk == EMPTY_QUEUE) {
+                break;
+            }
+            int low = chunk * state.chunkRows;
+            int high = low + state.chunkRows < height ?
+                low + state.chunkRows : height;
+            fetchRows(&state, pass, low - radius > 0 ? low - radius : 0,
+                high + radius < height ? high + radius : height);
+
+            // the slots start out empty, so every pass copies the edge
+            // samples of its chunk too
+            double start = MPI_Wtime();
+            image dst = slotImage(&state, 1 - pass % 2, state.used, chunk);
+            passJob filterJob = {&dst, &state.work, low, high, &st, def->conv};
+            if (def->conv == NULL) {  // kernel files copy their own edges
+                runPool(pool, copyBordersTask, &filterJob);
+            }
+            runPool(pool, applyFilterTask, &filterJob);
+            busy += MPI_Wtime() - start;
+            profileFilter(def, start, (long)(high - low) *
+                state.work.rowSamples * state.work.planes);
+
+            rows += high - low;
+            produced[chunk] = state.rank;
+            filled[chunk] = state.used++;
+        }
+
+        // every chunk is done once every rank is here; the stores reach the
+        // windows before anybody reads them
+        begin = profileBegin();
+        MPI_Win_sync(state.slotWindows[1 - pass % 2]);
+        MPI_Allreduce(produced, state.producer, state.chunkCount, MPI_INT,
+            MPI_MAX, comm);
+        MPI_Allreduce(filled, state.slot, state.chunkCount, MPI_INT, MPI_MAX,
+            comm);
+        double rate = busy > 0 ? rows / busy : 0;
+        MPI_Allgather(&rate, 1, MPI_DOUBLE, rates, 1, MPI_DOUBLE, comm);
+        profilePhase(PHASE_WAIT, begin, 0);
+
+        // a rank that got no chunk keeps an average share, and every rank
+        // an even one when none measured a rate
+        double total = 0;
+        int measured = 0;
+        for (int i = 0; i < state.size; i++) {
+            total += rates[i];
+            measured += rates[i] > 0;
+        }
+        for (int i = 0; i < state.size; i++) {
+            rates[i] = rates[i] > 0 || measured == 0 ? rates[i] :
+                total / measured;
+        }
+        splitChunks(rates, state.size, state.chunkCount, state.slotCount,
+            firsts);
+    }
+
+    // every rank writes the chunks it computed last, or its share of the
+    // input when there is no filter
+    long headerSize = prepareOutput(job->output, &shape, comm);
+    int fd = open(job->output, O_WRONLY);
+    if (fd < 0) {
+        perror("error opening output file");
+        MPI_Abort(comm, 1);
+    }
+    for (int chunk = 0; chunk < state.chunkCount; chunk++) {
+        int low = chunk * state.chunkRows;
+        int high = low + state.chunkRows < height ?
+            low + state.chunkRows : height;
+        image output;
+
+        if (filterCount > 0 && state.producer[chunk] == state.rank) {
+            output = slotImage(&state, filterCount % 2, state.slot[chunk],
+                chunk);
+        } else if (filterCount == 0 && chunk >= firsts[state.rank] &&
+            chunk < firsts[state.rank + 1]) {
+            fetchRows(&state, 0, low, high);
+            output = state.work;
+        } else {
+            continue;
+        }
+        begin = profileBegin();
+        lseek(fd, headerSize + low * state.rowBytes, SEEK_SET);
+        writeRows(fd, &output, low, high - low);
+        profilePhase(PHASE_WRITE, begin, (long)(high - low) * state.rowBytes);
+    }
+    close(fd);
+
+    MPI_Win_unlock_all(state.queueWindow);
+    MPI_Win_free(&state.queueWindow);
+    for (int b = 0; b < 2; b++) {
+        MPI_Win_unlock_all(state.slotWindows[b]);
+        MPI_Win_free(&state.slotWindows[b]);
+        free(state.paddings[b]);
+    }
+    freeImage(&state.work);
+    unmapFile(&state.input);
+    free(state.producer);
+    free(state.slot);
+    free(produced);
+    free(filled);
+    free(rates);
+    free(firsts);
+}
@@ -0,0 +1,25 @@
+#ifndef STEAL_H
+#define STEAL_H
+
+#include <mpi.h>
+
+#include "process.h"
+
+#define NO_STEAL 0
+#define AUTO_CHUNK -1
+#define STEAL_CHUNKS_PER_RANK 8  // chunks per rank picked by auto
+#define STEAL_SLACK 2  // even shares of chunks a rank can hold, steals included
+#define FROM_FILE -1  // producer of the input rows
+
+// filter one image with every rank of comm, the rows cut in chunks: each
+// pass, every rank takes its own chunks from the front of a queue and,
+// once it runs out, steals from the back of the fullest queue of another
+// rank through one-sided atomics, as long as it has room for the chunk.
+// Every rank keeps the chunks it computed in slots of a window, the rows a
+// chunk reads are fetched from whichever rank holds them, and the queues
+// of the next pass are sized by the throughput each rank measured; gives
+// the same pixels as processImage
+void stealImage(const imageJob *job, const options *opts, threadPool *pool,
+    MPI_Comm comm);
+
+#endif
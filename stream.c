@@ -0,0 +1,176 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stream.h"
+#include "bandio.h"
+#include "pnm.h"
+#include "profile.h"
+
+int windowEnd(const image *window) {
+    return window->firstRow + window->rows;
+}
+
+void slideWindow(image *window, int keepFrom) {
+    int keep = windowEnd(window) - keepFrom;
+
+    if (keepFrom <= window->firstRow) {
+        return;
+    }
+    for (int p = 0; p < window->planes && keep > 0; p++) {
+        memmove(imageRow(window, p, window->firstRow),
+            imageRow(window, p, keepFrom), keep * window->stride);
+    }
+    window->firstRow = keepFrom;
+    window->rows = keep;
+}
+
+int runStage(image *src, image *dst, int capacity, const stencil *st,
+    const convolution *conv, threadPool *pool) {
+    int radius = conv != NULL ? conv->radius : 1;
+    int end = windowEnd(src);
+    int first = windowEnd(dst);
+    // the last rows wait for the radius below them, unless they end the image
+    int last = end == src->height ? end : end - radius;
+    // and for a later call once dst is full
+    if (last > dst->firstRow + capacity) {
+        last = dst->firstRow + capacity;
+    }
+
+    if (first >= last) {
+        return 0;
+    }
+    dst->rows = last - dst->firstRow;
+
+    // only the border samples, the filter writes every other one
+    passJob filterJob = {dst, src, first, last, st, conv};
+    if (conv == NULL) {  // kernel files copy their own edges
+        runPool(pool, copyBordersTask, &filterJob);
+    }
+    runPool(pool, applyFilterTask, &filterJob);
+
+    // the next row still reads the radius above it
+    slideWindow(src, last - radius);
+    return last - first;
+}
+
+void streamImage(const imageJob *job, const options *opts, threadPool *pool,
+    MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    image shape;
+    double begin = profileBegin();
+    long dataOffset = shareHeader(job->input, &shape, opts->layout, comm);
+    profilePhase(PHASE_HEADER, begin, dataOffset);
+    int height = shape.height;
+    int filterCount = job->filterCount;
+    size_t rowBytes = fileRowBytes(&shape);
+
+    // every rank still owns a band, but recomputes the rows past its edges
+    // instead of exchanging them, so it reads the radii of every filter
+    // more on each side
+    int rowLow, rowHigh;
+    int chainRows = chainRadius(job, 0, filterCount);
+    computeBand(height, rank, size, &rowLow, &rowHigh);
+    int inLow = rowLow - chainRows > 0 ? rowLow - chainRows : 0;
+    int inHigh = rowHigh + chainRows < height ? rowHigh + chainRows : height;
+
+    int stripeRows = opts->stripeRows;
+    if (stripeRows == AUTO_STRIPE) {
+        stripeRows = STREAM_STRIPE_BYTES / rowBytes > 0 ?
+            STREAM_STRIPE_BYTES / rowBytes : 1;
+    }
+
+    // window s holds the input rows of filter s, the last one the output;
+    // each filter hands on as many rows as it got and keeps twice its
+    // radius, and the rows the image end lets out at once wait for room
+    int *capacities = (int *)malloc((filterCount + 1) * sizeof(int));
+    for (int s = 0; s < filterCount; s++) {
+        capacities[s] = stripeRows + 2 * filterRadius(job->chain[s]);
+    }
+    capacities[filterCount] = stripeRows;
+    image *windows = (image *)malloc((filterCount + 1) * sizeof(image));
+    stencil *stencils = (stencil *)malloc(
+        (filterCount > 0 ? filterCount : 1) * sizeof(stencil));
+    int firstRow = inLow;
+    for (int s = 0; s <= filterCount; s++) {
+        windows[s] = shape;
+        allocRows(&windows[s], firstRow, capacities[s]);
+        windows[s].rows = 0;
+        // a filter writes nothing for the first radius rows it reads, but
+        // the top rows of the image are copied through
+        firstRow = firstRow == 0 || s == filterCount ? firstRow :
+            firstRow + filterRadius(job->chain[s]);
+    }
+    for (int s = 0; s < filterCount; s++) {
+        prepareFilter(&stencils[s], job->chain[s]);
+    }
+
+    long headerSize = prepareOutput(job->output, &shape, comm);
+    int fd = -1;
+    if (rowLow < rowHigh) {
+        fd = open(job->output, O_WRONLY);
+        if (fd < 0) {
+            perror("error opening output file");
+            MPI_Abort(comm, 1);
+        }
+        lseek(fd, headerSize + rowLow * rowBytes, SEEK_SET);
+    }
+
+    image *output = &windows[filterCount];
+    int row = inLow;
+    int moved = 0;
+    while (rowLow < rowHigh && (row < inHigh || moved > 0)) {
+        int rows = inHigh - row < stripeRows ? inHigh - row : stripeRows;
+        int room = capacities[0] - windows[0].rows;
+        rows = rows < room ? rows : room;
+
+        // map only the stripe, then push it through every filter; past the
+        // input the windows drain until no filter moves a row
+        if (rows > 0) {
+            mappedFile map;
+            begin = profileBegin();
+            mapFile(job->input, dataOffset + row * rowBytes, rows * rowBytes,
+                0, &map);
+            windows[0].rows += rows;
+            loadRows(&windows[0], row, rows, map.bytes);
+            unmapFile(&map);
+            profilePhase(PHASE_READ, begin, (long)rows * rowBytes);
+            row += rows;
+        }
+
+        moved = 0;
+        for (int s = 0; s < filterCount; s++) {
+            begin = profileBegin();
+            int filtered = runStage(&windows[s], &windows[s + 1],
+                capacities[s + 1], &stencils[s], job->chain[s]->conv, pool);
+            profileFilter(job->chain[s], begin,
+                (long)filtered * shape.rowSamples * shape.planes);
+            moved += filtered;
+        }
+
+        // write the rows of the band that came out, drop the recomputed ones
+        int low = output->firstRow > rowLow ? output->firstRow : rowLow;
+        int high = windowEnd(output) < rowHigh ? windowEnd(output) : rowHigh;
+        if (low < high) {
+            begin = profileBegin();
+            writeRows(fd, output, low, high - low);
+            profilePhase(PHASE_WRITE, begin, (long)(high - low) * rowBytes);
+        }
+        slideWindow(output, windowEnd(output));
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    for (int s = 0; s <= filterCount; s++) {
+        freeImage(&windows[s]);
+    }
+    free(windows);
+    free(capacities);
+    free(stencils);
+}
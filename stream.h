@@ -0,0 +1,29 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <mpi.h>
+
+#include "process.h"
+
+#define NO_STREAM 0
+#define AUTO_STRIPE -1
+#define STREAM_STRIPE_BYTES (4 << 20)  // samples per stripe picked by auto
+
+// first row past the rows a window holds
+int windowEnd(const image *window);
+// forget the rows of a window before keepFrom, moving the rest to the front
+void slideWindow(image *window, int keepFrom);
+// filter every row the window of a stage allows onto the end of dst, up to
+// capacity rows in dst, then forget the rows no later output row reads;
+// returns the rows filtered
+int runStage(image *src, image *dst, int capacity, const stencil *st,
+    const convolution *conv, threadPool *pool);
+
+// filter one image with every rank of comm without holding its band: the
+// input goes through the chain in stripes of rows, each filter keeping a
+// rolling window of the rows it still reads, so memory grows with the width
+// and the chain length only; gives the same pixels as processImage
+void streamImage(const imageJob *job, const options *opts, threadPool *pool,
+    MPI_Comm comm);
+
+#endif
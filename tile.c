@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tile.h"
+#include "bandio.h"
+#include "profile.h"
+
+void chooseGrid(int width, int height, int size, int dims[2]) {
+    long long bestCost = -1;
+    int bestFits = 0;
+
+    dims[0] = size;
+    dims[1] = 1;
+    for (int rows = 1; rows <= size; rows++) {
+        if (size % rows != 0) {
+            continue;
+        }
+        int columns = size / rows;
+        // grids leaving no tile empty come first
+        int fits = rows <= height && columns <= width;
+        // every cut between two tile rows is width long and the other way
+        // round, so that is the halo of the whole grid
+        long long cost = (long long)(rows - 1) * width
+            + (long long)(columns - 1) * height;
+
+        if (bestCost < 0 || fits > bestFits
+            || (fits == bestFits && cost < bestCost)) {
+            bestCost = cost;
+            bestFits = fits;
+            dims[0] = rows;
+            dims[1] = columns;
+        }
+    }
+}
+
+// swap the depth columns of the tile edges with the tiles beside it, for
+// the tile rows; first and last columns are local
+static void exchangeColumns(image *img, int rowLow, int rowHigh,
+    int colFirst, int colLast, int depth, int westRank, int eastRank,
+    MPI_Comm comm) {
+    int westCount = westRank != MPI_PROC_NULL ? 1 : 0;
+    int eastCount = eastRank != MPI_PROC_NULL ? 1 : 0;
+    unsigned char *row = imageRow(img, 0, rowLow);
+    int step = img->step;
+    MPI_Datatype columnBlock, columnsType;
+    double begin = profileBegin();
+
+    // depth samples of every tile row, then the same in every plane
+    MPI_Type_create_hvector(rowHigh - rowLow, depth * step,
+        (MPI_Aint)img->stride, MPI_UNSIGNED_CHAR, &columnBlock);
+    MPI_Type_create_hvector(img->planes, 1, (MPI_Aint)img->planeSize,
+        columnBlock, &columnsType);
+    MPI_Type_commit(&columnsType);
+    MPI_Type_free(&columnBlock);
+
+    // first columns go west, the east ghost columns come from the east
+    MPI_Sendrecv(row + colFirst * step, westCount, columnsType, westRank,
+        HALO_TAG, row + (eastCount ? colLast : colFirst) * step, eastCount,
+        columnsType, eastRank, HALO_TAG, comm, MPI_STATUS_IGNORE);
+    // last columns go east, the west ghost columns come from the west
+    MPI_Sendrecv(row + (colLast - depth) * step, eastCount, columnsType,
+        eastRank, HALO_TAG, row + (westCount ? colFirst - depth : colFirst)
+        * step, westCount, columnsType, westRank, HALO_TAG, comm,
+        MPI_STATUS_IGNORE);
+    MPI_Type_free(&columnsType);
+    profilePhase(PHASE_HALO, begin, (long)(westCount + eastCount) * depth *
+        step * (rowHigh - rowLow) * img->planes);
+}
+
+void tileImage(const imageJob *job, const options *opts, threadPool *pool,
+    MPI_Comm comm) {
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    // read the image header once, on the leader
+    image shape;
+    double begin = profileBegin();
+    long dataOffset = shareHeader(job->input, &shape, opts->layout, comm);
+    profilePhase(PHASE_HEADER, begin, dataOffset);
+    int height = shape.height;
+    int width = shape.width;
+
+    // a kernel reaching past the thinnest tile would need the ghost rows of
+    // several neighbours, the image goes to fewer, larger tiles instead
+    int radius = widestRadius(job);
+    int ranks = size;
+    int dims[2];
+    for (; ranks > 1; ranks--) {
+        chooseGrid(width, height, ranks, dims);
+        if (haloLimit(height, dims[0]) >= radius &&
+            haloLimit(width, dims[1]) >= radius) {
+            break;
+        }
+    }
+    if (ranks < size) {
+        int worldRank;
+        MPI_Comm group;
+        MPI_Comm_rank(comm, &worldRank);
+        MPI_Comm_split(comm, worldRank < ranks ? 0 : MPI_UNDEFINED, worldRank,
+            &group);
+        if (group != MPI_COMM_NULL) {
+            tileImage(job, opts, pool, group);
+            MPI_Comm_free(&group);
+        }
+        return;
+    }
+
+    // ranks as a grid the shape of the image, reordered to suit the network
+    int periods[2] = {0, 0};
+    int coords[2];
+    int rank;
+    MPI_Comm grid;
+    chooseGrid(width, height, size, dims);
+    MPI_Cart_create(comm, 2, dims, periods, 1, &grid);
+    MPI_Comm_rank(grid, &rank);
+    MPI_Cart_coords(grid, rank, 2, coords);
+
+    // the tile: balanced bands of rows and of columns
+    tileRect own;
+    computeBand(height, coords[0], dims[0], &own.rowLow, &own.rowHigh);
+    computeBand(width, coords[1], dims[1], &own.colLow, &own.colHigh);
+    int empty = own.rowLow == own.rowHigh || own.colLow == own.colHigh;
+
+    // empty tiles only ever come last, after a tile reaching the edge
+    int northRank, southRank, westRank, eastRank;
+    MPI_Cart_shift(grid, 0, 1, &northRank, &southRank);
+    MPI_Cart_shift(grid, 1, 1, &westRank, &eastRank);
+    if (empty) {
+        northRank = southRank = westRank = eastRank = MPI_PROC_NULL;
+    }
+    if (own.rowHigh == height) {
+        southRank = MPI_PROC_NULL;
+    }
+    if (own.colHigh == width) {
+        eastRank = MPI_PROC_NULL;
+    }
+
+    // the halo has to fit in the thinnest tile either way
+    int filterCount = job->filterCount;
+    int rowDepth = chooseBlockDepth(opts->blockDepth, filterCount, height,
+        dims[0]);
+    int colDepth = chooseBlockDepth(opts->blockDepth, filterCount, width,
+        dims[1]);
+    int blockDepth = rowDepth < colDepth ? rowDepth : colDepth;
+    int rowLimit = haloLimit(height, dims[0]);
+    int colLimit = haloLimit(width, dims[1]);
+    int limit = rowLimit < colLimit ? rowLimit : colLimit;
+    int haloRows = 0;  // and columns, the radii of the deepest block
+    for (int blockStart = 0, blockEnd; blockStart < filterCount;
+        blockStart = blockEnd) {
+        blockEnd = nextBlock(job, blockStart, blockDepth, limit);
+        int rows = chainRadius(job, blockStart, blockEnd);
+        haloRows = rows > haloRows ? rows : haloRows;
+    }
+
+    // read the tile and the ghost rows and columns of the first block
+    tileRect store = own;
+    if (!empty) {
+        store.rowLow = own.rowLow - haloRows > 0 ? own.rowLow - haloRows : 0;
+        store.rowHigh = own.rowHigh + haloRows < height ?
+            own.rowHigh + haloRows : height;
+        store.colLow = own.colLow - haloRows > 0 ? own.colLow - haloRows : 0;
+        store.colHigh = own.colHigh + haloRows < width ?
+            own.colHigh + haloRows : width;
+    }
+    // columns are local to the tile, rows keep their image numbers so the
+    // top and bottom image rows are still left alone
+    image tile;
+    initImage(&tile, shape.type, store.colHigh - store.colLow, height,
+        shape.maxval, opts->layout);
+    begin = profileBegin();
+    readTile(job->input, &shape, dataOffset, &tile, store, opts->io, grid);
+    profilePhase(PHASE_READ, begin, (long)(store.rowHigh - store.rowLow) *
+        (store.colHigh - store.colLow) * shape.channels);
+    int colFirst = own.colLow - store.colLow;
+    int colLast = own.colHigh - store.colLow;
+
+    // ping-pong buffers, as for bands
+    image buffers[2];
+    stencil st;
+    buffers[0] = tile;
+    buffers[1] = tile;
+    allocRows(&buffers[1], store.rowLow, store.rowHigh - store.rowLow);
+    passJob copyJob = {&buffers[1], &buffers[0], store.rowLow, store.rowHigh,
+        NULL};
+    begin = profileBegin();
+    runPool(pool, copyRowsTask, &copyJob);
+    profilePhase(PHASE_COPY, begin,
+        (long)(store.rowHigh - store.rowLow) * tile.stride * tile.planes);
+    int current = 0;
+
+    int blockEnd;
+    for (int blockStart = 0; blockStart < filterCount && !empty;
+        blockStart = blockEnd) {
+        blockEnd = nextBlock(job, blockStart, blockDepth, limit);
+        int depth = chainRadius(job, blockStart, blockEnd);
+
+        // refresh the ghost columns, then the ghost rows with their corners
+        if (blockStart > 0) {
+            exchangeColumns(&buffers[current], own.rowLow, own.rowHigh,
+                colFirst, colLast, depth, westRank, eastRank, grid);
+            exchangeHalo(&buffers[current], own.rowLow, own.rowHigh, depth,
+                northRank, southRank, grid);
+        }
+
+        for (int filterIndex = blockStart; filterIndex < blockEnd; filterIndex++) {
+            prepareFilter(&st, job->chain[filterIndex]);
+
+            // every stored column is filtered, the ghost ones go stale a
+            // radius per filter from the outside in, like the ghost rows
+            int margin = chainRadius(job, filterIndex + 1, blockEnd);
+            int computeLow = northRank != MPI_PROC_NULL ?
+                own.rowLow - margin : own.rowLow;
+            int computeHigh = southRank != MPI_PROC_NULL ?
+                own.rowHigh + margin : own.rowHigh;
+
+            passJob filterJob = {&buffers[1 - current], &buffers[current],
+                computeLow, computeHigh, &st, job->chain[filterIndex]->conv};
+            begin = profileBegin();
+            runPool(pool, applyFilterTask, &filterJob);
+            profileFilter(job->chain[filterIndex], begin,
+                (long)(computeHigh - computeLow) * tile.rowSamples * tile.planes);
+            current = 1 - current;
+        }
+    }
+
+    begin = profileBegin();
+    writeTiles(job->output, &shape, &buffers[current], colFirst, own,
+        opts->io, grid);
+    profilePhase(PHASE_WRITE, begin, (long)(own.rowHigh - own.rowLow) *
+        (own.colHigh - own.colLow) * shape.channels);
+
+    MPI_Comm_free(&grid);
+    freeImage(&buffers[0]);
+    freeImage(&buffers[1]);
+}
@@ -0,0 +1,18 @@
+#ifndef TILE_H
+#define TILE_H
+
+#include <mpi.h>
+
+#include "process.h"
+
+// split size ranks in a rows x columns grid for a width x height image,
+// with the least halo: the smallest sum of tile perimeters
+void chooseGrid(int width, int height, int size, int dims[2]);
+
+// filter one image with every rank of comm, each owning a 2D tile; ranks
+// swap ghost columns with the tiles beside them, then ghost rows as wide as
+// the tile and its ghost columns with the tiles above and below
+void tileImage(const imageJob *job, const options *opts, threadPool *pool,
+    MPI_Comm comm);
+
+#endif
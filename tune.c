@@ -0,0 +1,401 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tune.h"
+#include "bandio.h"
+#include "kernels.h"
+#include "stream.h"
+#include "steal.h"
+
+#define TUNING_SEPARATORS " \t\r\n"
+#define NAME_LENGTH 16
+
+// log2 of the pixels of an image, rounded down
+static int sizeClass(const image *img) {
+    long pixels = (long)img->width * img->height;
+    int log = 0;
+
+    while (pixels > 1) {
+        pixels >>= 1;
+        log++;
+    }
+    return log;
+}
+
+static int sameClass(const tuningEntry *a, const tuningEntry *b) {
+    return a->sizeClass == b->sizeClass && a->channels == b->channels &&
+        a->filterCount == b->filterCount;
+}
+
+// replace the entry of the same class, or add one
+static void setEntry(tuning *tuned, const tuningEntry *entry) {
+    for (int i = 0; i < tuned->count; i++) {
+        if (sameClass(&tuned->entries[i], entry)) {
+            tuned->entries[i] = *entry;
+            return;
+        }
+    }
+    if (tuned->count == MAX_TUNING_ENTRIES) {
+        fprintf(stderr, "more than %d tuning entries\n", MAX_TUNING_ENTRIES);
+        exit(1);
+    }
+    tuned->entries[tuned->count++] = *entry;
+}
+
+tuning *loadTuning(const char *fileName, int required) {
+    FILE *filePointer = fopen(fileName, "r");
+    if (filePointer == NULL && !required && errno == ENOENT) {
+        return NULL;
+    }
+    if (filePointer == NULL) {
+        perror("error opening tuning file");
+        exit(1);
+    }
+
+    tuning *tuned = (tuning *)calloc(1, sizeof(tuning));
+    char *line = NULL;
+    size_t length = 0;
+    while (getline(&line, &length, filePointer) != -1) {
+        size_t start = strspn(line, TUNING_SEPARATORS);
+        if (line[start] == '\0' || line[start] == '#') {
+            continue;
+        }
+
+        tuningEntry entry;
+        char isa[NAME_LENGTH], layout[NAME_LENGTH], block[NAME_LENGTH];
+        int fields = sscanf(line + start, "%d %d %d %d %d %15s %15s %15s %lf",
+            &entry.sizeClass, &entry.channels, &entry.filterCount,
+            &entry.ranks, &entry.threads, isa, layout, block, &entry.seconds);
+        if (fields == 9) {
+            entry.tiles = strcmp(layout, "tiles") == 0;
+            entry.blockDepth = strcmp(block, "auto") == 0 ? AUTO_BLOCK :
+                atoi(block);
+        }
+        if (fields != 9 || entry.ranks < 1 || entry.threads < 1 ||
+            (!entry.tiles && strcmp(layout, "bands") != 0) ||
+            (entry.blockDepth < 1 && entry.blockDepth != AUTO_BLOCK)) {
+            fprintf(stderr, "invalid tuning line: %s", line + start);
+            exit(1);
+        }
+        entry.isa = parseIsa(isa);
+        setEntry(tuned, &entry);
+    }
+    free(line);
+    fclose(filePointer);
+    return tuned;
+}
+
+static int classOrder(const void *a, const void *b) {
+    const tuningEntry *first = (const tuningEntry *)a;
+    const tuningEntry *second = (const tuningEntry *)b;
+
+    if (first->channels != second->channels) {
+        return first->channels - second->channels;
+    }
+    if (first->sizeClass != second->sizeClass) {
+        return first->sizeClass - second->sizeClass;
+    }
+    return first->filterCount - second->filterCount;
+}
+
+static void writeTuning(const char *fileName, tuning *tuned) {
+    FILE *filePointer = fopen(fileName, "w");
+    if (filePointer == NULL) {
+        perror("error opening tuning file");
+        exit(1);
+    }
+
+    qsort(tuned->entries, tuned->count, sizeof(tuningEntry), classOrder);
+    fprintf(filePointer, "# written by homework --autotune: size class (log2 "
+        "of the pixels), channels\n# and filters of a job, then its fastest "
+        "ranks, threads, kernels, layout\n# and block depth, and the seconds "
+        "of one run\n");
+    for (int i = 0; i < tuned->count; i++) {
+        const tuningEntry *entry = &tuned->entries[i];
+        char block[NAME_LENGTH];
+        if (entry->blockDepth == AUTO_BLOCK) {
+            strcpy(block, "auto");
+        } else {
+            snprintf(block, NAME_LENGTH, "%d", entry->blockDepth);
+        }
+        fprintf(filePointer, "%d %d %d %d %d %s %s %s %.6f\n",
+            entry->sizeClass, entry->channels, entry->filterCount,
+            entry->ranks, entry->threads, isaName(entry->isa),
+            entry->tiles ? "tiles" : "bands", block, entry->seconds);
+    }
+    fclose(filePointer);
+}
+
+int tunedThreads(const tuning *tuned) {
+    int threads = 1;
+
+    for (int i = 0; i < tuned->count; i++) {
+        if (tuned->entries[i].threads > threads) {
+            threads = tuned->entries[i].threads;
+        }
+    }
+    return threads;
+}
+
+int tuneThreads(MPI_Comm comm) {
+    MPI_Comm node;
+    int ranksOnNode;
+
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    MPI_Comm_size(node, &ranksOnNode);
+    MPI_Comm_free(&node);
+
+    // mpirun may bind every rank to fewer cpus than its share
+    int share = (int)sysconf(_SC_NPROCESSORS_ONLN) / ranksOnNode;
+    int allowed = availableCpus();
+    share = share < allowed ? share : allowed;
+    return share > 1 ? share : 1;
+}
+
+// the entry with the same channels, the nearest size class and then the
+// nearest chain length, NULL if no entry has the channels
+static const tuningEntry *findEntry(const tuning *tuned,
+    const tuningEntry *wanted) {
+    const tuningEntry *best = NULL;
+    int bestClass = 0;
+    int bestCount = 0;
+
+    for (int i = 0; i < tuned->count; i++) {
+        const tuningEntry *entry = &tuned->entries[i];
+        int classDistance = abs(entry->sizeClass - wanted->sizeClass);
+        int countDistance = abs(entry->filterCount - wanted->filterCount);
+        if (entry->channels != wanted->channels) {
+            continue;
+        }
+        if (best == NULL || classDistance < bestClass ||
+            (classDistance == bestClass && countDistance < bestCount)) {
+            best = entry;
+            bestClass = classDistance;
+            bestCount = countDistance;
+        }
+    }
+    return best;
+}
+
+// the class of a job, read from the header of its input
+static void classifyJob(const imageJob *job, const options *opts,
+    tuningEntry *entry, MPI_Comm comm) {
+    image shape;
+
+    shareHeader(job->input, &shape, opts->layout, comm);
+    memset(entry, 0, sizeof(tuningEntry));
+    entry->sizeClass = sizeClass(&shape);
+    entry->channels = shape.channels;
+    entry->filterCount = job->filterCount;
+}
+
+// filter one image with the settings of entry on the first entry->ranks
+// ranks of comm, the settings fixed by opts left as they are
+static void runEntry(const imageJob *job, const tuningEntry *entry,
+    const options *opts, threadPool *pool, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    options settings = *opts;
+    settings.tuned = NULL;
+    if (!(opts->fixed & FIXED_LAYOUT)) {
+        settings.tiles = entry->tiles;
+    }
+    if (!(opts->fixed & FIXED_BLOCK)) {
+        settings.blockDepth = entry->blockDepth;
+    }
+    // a file tuned on another machine may name kernels this cpu lacks
+    int isa = activeIsa();
+    if (!(opts->fixed & FIXED_ISA)) {
+        selectKernels(entry->isa > detectIsa() ? ISA_AUTO : entry->isa);
+    }
+    if (!(opts->fixed & FIXED_THREADS)) {
+        setPoolThreads(pool, entry->threads);
+    }
+
+    MPI_Comm group = comm;
+    if (entry->ranks < size) {
+        MPI_Comm_split(comm, rank < entry->ranks ? 0 : MPI_UNDEFINED, rank,
+            &group);
+    }
+    if (group != MPI_COMM_NULL) {
+        processImage(job, &settings, pool, group);
+    }
+    if (group != comm && group != MPI_COMM_NULL) {
+        MPI_Comm_free(&group);
+    }
+
+    selectKernels(isa);
+    setPoolThreads(pool, pool->threads);
+}
+
+void tunedImage(const imageJob *job, const options *opts, threadPool *pool,
+    MPI_Comm comm) {
+    tuningEntry wanted;
+
+    classifyJob(job, opts, &wanted, comm);
+    const tuningEntry *entry = findEntry(opts->tuned, &wanted);
+    if (entry == NULL) {  // no image with these channels was tuned
+        options untuned = *opts;
+        untuned.tuned = NULL;
+        processImage(job, &untuned, pool, comm);
+        return;
+    }
+    runEntry(job, entry, opts, pool, comm);
+}
+
+// seconds of the fastest of TUNE_REPEAT runs, the slowest rank of each
+// counts so every rank picks the same winner
+static double timeEntry(const imageJob *job, const tuningEntry *entry,
+    const options *opts, threadPool *pool, MPI_Comm comm) {
+    double fastest = 0;
+
+    for (int i = 0; i < TUNE_REPEAT; i++) {
+        MPI_Barrier(comm);
+        double start = MPI_Wtime();
+        runEntry(job, entry, opts, pool, comm);
+        double seconds = MPI_Wtime() - start;
+        MPI_Allreduce(MPI_IN_PLACE, &seconds, 1, MPI_DOUBLE, MPI_MAX, comm);
+        if (i == 0 || seconds < fastest) {
+            fastest = seconds;
+        }
+    }
+    return fastest;
+}
+
+// keep candidate as the best when it runs faster
+static void tryEntry(const imageJob *job, tuningEntry *candidate,
+    tuningEntry *best, const options *opts, threadPool *pool, MPI_Comm comm) {
+    candidate->seconds = timeEntry(job, candidate, opts, pool, comm);
+    if (candidate->seconds < best->seconds) {
+        *best = *candidate;
+    }
+}
+
+// the next power of two after count, then limit, then past it
+static int nextCount(int count, int limit) {
+    return count < limit && 2 * count > limit ? limit : 2 * count;
+}
+
+static void tuneJob(const imageJob *job, tuningEntry *best,
+    const options *opts, threadPool *pool, MPI_Comm comm) {
+    int size;
+    MPI_Comm_size(comm, &size);
+    int fixed = opts->fixed;
+
+    // what a run without the tuning does, on every rank
+    best->ranks = size;
+    best->threads = fixed & FIXED_THREADS ? pool->threads : 1;
+    best->isa = fixed & FIXED_ISA ? opts->isa : detectIsa();
+    best->tiles = opts->tiles;
+    best->blockDepth = opts->blockDepth;
+    best->seconds = timeEntry(job, best, opts, pool, comm);
+    double untuned = best->seconds;
+    tuningEntry candidate;
+
+    if (!(fixed & FIXED_ISA)) {
+        for (int isa = ISA_SCALAR; isa <= detectIsa(); isa++) {
+            candidate = *best;
+            candidate.isa = isa;
+            if (isa != best->isa) {
+                tryEntry(job, &candidate, best, opts, pool, comm);
+            }
+        }
+    }
+
+    // ranks and threads trade off, so every pair within the cpus of the
+    // job is tried
+    int maxThreads = pool->threads;
+    int firstThreads = fixed & FIXED_THREADS ? maxThreads : 1;
+    int baseRanks = best->ranks;
+    int baseThreads = best->threads;
+    for (int ranks = 1; ranks <= size; ranks = nextCount(ranks, size)) {
+        for (int threads = firstThreads; threads <= maxThreads;
+            threads = nextCount(threads, maxThreads)) {
+            candidate = *best;
+            candidate.ranks = ranks;
+            candidate.threads = threads;
+            if (ranks * threads <= size * maxThreads &&
+                (ranks != baseRanks || threads != baseThreads)) {
+                tryEntry(job, &candidate, best, opts, pool, comm);
+            }
+        }
+    }
+
+    // the streaming, stealing and shared modes come before the layout
+    if (!(fixed & FIXED_LAYOUT) && opts->stripeRows == NO_STREAM &&
+        opts->stealRows == NO_STEAL && !opts->shared) {
+        candidate = *best;
+        candidate.tiles = !best->tiles;
+        tryEntry(job, &candidate, best, opts, pool, comm);
+    }
+
+    if (!(fixed & FIXED_BLOCK) && job->filterCount > 1) {
+        int depths = job->filterCount < MAX_BLOCK_DEPTH ? job->filterCount :
+            MAX_BLOCK_DEPTH;
+        for (int depth = AUTO_BLOCK; depth <= depths;
+            depth = depth == AUTO_BLOCK ? 1 : 2 * depth) {
+            candidate = *best;
+            candidate.blockDepth = depth;
+            if (depth != best->blockDepth) {
+                tryEntry(job, &candidate, best, opts, pool, comm);
+            }
+        }
+    }
+
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0) {
+        char block[NAME_LENGTH];
+        if (best->blockDepth == AUTO_BLOCK) {
+            strcpy(block, "auto");
+        } else {
+            snprintf(block, NAME_LENGTH, "%d", best->blockDepth);
+        }
+        printf("2^%d pixels, %d channels, %d filters: %d ranks x %d threads, "
+            "%s kernels, %s, block %s: %.6f s, %.2fx untuned\n",
+            best->sizeClass, best->channels, best->filterCount, best->ranks,
+            best->threads, isaName(best->isa), best->tiles ? "tiles" : "bands",
+            block, best->seconds,
+            best->seconds > 0 ? untuned / best->seconds : 1.0);
+    }
+}
+
+void autotune(const imageJob *jobs, int count, const options *opts,
+    threadPool *pool, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    // only the first job of a class is timed
+    tuning *found = (tuning *)calloc(1, sizeof(tuning));
+    for (int i = 0; i < count; i++) {
+        tuningEntry entry;
+        classifyJob(&jobs[i], opts, &entry, comm);
+        const tuningEntry *nearest = findEntry(found, &entry);
+        if (nearest != NULL && sameClass(nearest, &entry)) {
+            continue;
+        }
+        tuneJob(&jobs[i], &entry, opts, pool, comm);
+        setEntry(found, &entry);
+    }
+
+    // the classes of earlier runs stay
+    if (rank == 0) {
+        tuning *tuned = loadTuning(opts->tuneFile, 0);
+        if (tuned == NULL) {
+            tuned = (tuning *)calloc(1, sizeof(tuning));
+        }
+        for (int i = 0; i < found->count; i++) {
+            setEntry(tuned, &found->entries[i]);
+        }
+        writeTuning(opts->tuneFile, tuned);
+        printf("%d classes tuned, %d in %s\n", found->count, tuned->count,
+            opts->tuneFile);
+        free(tuned);
+    }
+    free(found);
+}
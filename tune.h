@@ -0,0 +1,62 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <mpi.h>
+
+#include "process.h"
+
+#define DEFAULT_TUNING_FILE "homework.tune"  // loaded when present
+#define MAX_TUNING_ENTRIES 256
+#define TUNE_REPEAT 3  // runs of every configuration, the fastest counts
+
+// settings given on the command line, which the tuning leaves alone
+#define FIXED_ISA 1
+#define FIXED_THREADS 2
+#define FIXED_LAYOUT 4
+#define FIXED_BLOCK 8
+
+// the fastest configuration for a class of jobs
+typedef struct {
+    int sizeClass;  // log2 of the pixels, rounded down
+    int channels;  // IMAGE_SIZE_BW or IMAGE_SIZE_COL
+    int filterCount;
+    int ranks;
+    int threads;
+    int isa;
+    int tiles;  // tiles instead of bands of rows
+    int blockDepth;  // filters per halo exchange, AUTO_BLOCK to pick one
+    double seconds;  // of one run when it was tuned
+}tuningEntry;
+
+struct tuning {
+    tuningEntry entries[MAX_TUNING_ENTRIES];
+    int count;
+};
+
+// the entries of a tuning file, NULL if it does not exist and is not
+// required; exits on a malformed line
+tuning *loadTuning(const char *fileName, int required);
+
+// the most threads an entry runs, the pool has to start that many
+int tunedThreads(const tuning *tuned);
+
+// threads per rank the autotune tries at most: the cpus of the node
+// shared by the ranks on it
+int tuneThreads(MPI_Comm comm);
+
+// filter one image with the entry closest to it in opts->tuned: the same
+// channels, the nearest size class, then the nearest chain length. The
+// ranks past the tuned count sit the image out; gives the same pixels as
+// processImage
+void tunedImage(const imageJob *job, const options *opts, threadPool *pool,
+    MPI_Comm comm);
+
+// time the configurations on the first job of every class and write the
+// fastest of each to opts->tuneFile, keeping the entries of other classes
+// already there. One setting at a time, the others at their best so far:
+// kernels, then ranks and threads together, then bands or tiles, then the
+// block depth; a FIXED_* setting is not tried
+void autotune(const imageJob *jobs, int count, const options *opts,
+    threadPool *pool, MPI_Comm comm);
+
+#endif
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+// decode an 8-bit grey or RGB PNG back into P5 or P6, so compressed
+// outputs can be compared with raw ones; every chunk crc and the adler32
+// of the stream are checked
+#define CHUNK_PREFIX 8
+#define CHUNK_BYTES 12
+
+static const unsigned char signature[8] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+};
+
+static void fail(const char *why) {
+    fprintf(stderr, "invalid PNG: %s\n", why);
+    exit(1);
+}
+
+static unsigned long getBig(const unsigned char *bytes) {
+    return (unsigned long)bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 |
+        bytes[3];
+}
+
+static unsigned char *readFile(const char *fileName, size_t *size) {
+    FILE *filePointer = fopen(fileName, "rb");
+    if (filePointer == NULL) {
+        perror("error opening input file");
+        exit(1);
+    }
+    fseek(filePointer, 0, SEEK_END);
+    *size = ftell(filePointer);
+    fseek(filePointer, 0, SEEK_SET);
+    unsigned char *bytes = (unsigned char *)malloc(*size > 0 ? *size : 1);
+    if (fread(bytes, 1, *size, filePointer) != *size) {
+        perror("error reading input file");
+        exit(1);
+    }
+    fclose(filePointer);
+    return bytes;
+}
+
+static int paeth(int left, int above, int corner) {
+    int estimate = left + above - corner;
+    int toLeft = abs(estimate - left);
+    int toAbove = abs(estimate - above);
+    int toCorner = abs(estimate - corner);
+
+    if (toLeft <= toAbove && toLeft <= toCorner) {
+        return left;
+    }
+    return toAbove <= toCorner ? above : corner;
+}
+
+// undo the filter of a row in place, prior is the row above
+static void unfilterRow(int filter, unsigned char *row,
+    const unsigned char *prior, size_t rowBytes, int bpp) {
+    for (size_t i = 0; i < rowBytes; i++) {
+        int left = i >= (size_t)bpp ? row[i - bpp] : 0;
+        int above = prior[i];
+        int corner = i >= (size_t)bpp ? prior[i - bpp] : 0;
+        switch (filter) {
+        case 0:
+            break;
+        case 1:
+            row[i] += left;
+            break;
+        case 2:
+            row[i] += above;
+            break;
+        case 3:
+            row[i] += (left + above) / 2;
+            break;
+        case 4:
+            row[i] += paeth(left, above, corner);
+            break;
+        default:
+            fail("unknown row filter");
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s input.png output\n", argv[0]);
+        exit(1);
+    }
+
+    size_t size;
+    unsigned char *bytes = readFile(argv[1], &size);
+    if (size < sizeof(signature) ||
+        memcmp(bytes, signature, sizeof(signature)) != 0) {
+        fail("no signature");
+    }
+
+    // every IDAT joined, then inflated at once
+    unsigned long width = 0, height = 0;
+    int channels = 0;
+    unsigned char *stream = (unsigned char *)malloc(size);
+    size_t streamSize = 0;
+    for (size_t at = sizeof(signature); at + CHUNK_BYTES <= size;) {
+        unsigned long length = getBig(bytes + at);
+        const unsigned char *type = bytes + at + 4;
+        const unsigned char *data = bytes + at + CHUNK_PREFIX;
+        if (at + CHUNK_BYTES + length > size) {
+            fail("truncated chunk");
+        }
+        if (crc32(crc32(0, NULL, 0), type, length + 4) !=
+            getBig(data + length)) {
+            fail("chunk crc");
+        }
+        if (memcmp(type, "IHDR", 4) == 0) {
+            width = getBig(data);
+            height = getBig(data + 4);
+            channels = data[9] == 2 ? 3 : data[9] == 0 ? 1 : 0;
+            if (data[8] != 8 || channels == 0 || data[12] != 0) {
+                fail("only 8-bit grey or RGB, not interlaced");
+            }
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            memcpy(stream + streamSize, data, length);
+            streamSize += length;
+        }
+        at += CHUNK_BYTES + length;
+    }
+
+    size_t rowBytes = width * channels;
+    uLongf rawSize = (rowBytes + 1) * height;
+    unsigned char *raw = (unsigned char *)malloc(rawSize > 0 ? rawSize : 1);
+    if (uncompress(raw, &rawSize, stream, streamSize) != Z_OK ||
+        rawSize != (rowBytes + 1) * height) {
+        fail("image data");
+    }
+
+    FILE *output = fopen(argv[2], "wb");
+    if (output == NULL) {
+        perror("error opening output file");
+        exit(1);
+    }
+    fprintf(output, "P%d\n%lu %lu\n255\n", channels == 3 ? 6 : 5, width,
+        height);
+    unsigned char *zeros = (unsigned char *)calloc(rowBytes + 1, 1);
+    const unsigned char *prior = zeros;
+    for (unsigned long y = 0; y < height; y++) {
+        unsigned char *row = raw + y * (rowBytes + 1);
+        unfilterRow(row[0], row + 1, prior, rowBytes, channels);
+        fwrite(row + 1, 1, rowBytes, output);
+        prior = row + 1;
+    }
+    fclose(output);
+    free(zeros);
+    free(raw);
+    free(stream);
+    free(bytes);
+    return 0;
+}